@@ -11,8 +11,12 @@
 #include <stdint.h>          // fixed-width integer types
 
 // ta-expt library
+#include <boot_record.h>     // boot milestone functions
 #include <bootloader.h>      // microcontroller utility functions
+#include <crc32.h>           // CRC-32 functions
 #include <taolst_protocol.h> // protocol utility functions
+#include <timebase.h>        // monotonic timebase functions
+#include <trace.h>           // trace stream functions
 
 // Variables
 
@@ -22,37 +26,57 @@ int in_bootloader;
 //// app_jump_pending is an extern variable modified in write_reply
 int app_jump_pending;
 
+//// uart_baud_pending is an extern variable modified in write_reply
+uint32_t uart_baud_pending;
+
 // Main
 int main(void) {
   // Bootloader initialization
+  init_boot_record();
   init_clock();
+  init_timebase();                         // Needs the clock
+  boot_record_mark(BOOT_MARK_BLR_CLOCK);
   init_uart();
+  boot_record_mark(BOOT_MARK_BLR_UART);
   init_rtc();
+  boot_record_mark(BOOT_MARK_BLR_RTC);
+  init_trace();
+  init_crc32();
+  boot_record_mark(BOOT_MARK_BLR_INIT);
   rx_cmd_buff_t rx_cmd_buff = {.size=CMD_MAX_LEN};
   clear_rx_cmd_buff(&rx_cmd_buff);
   tx_cmd_buff_t tx_cmd_buff = {.size=CMD_MAX_LEN};
   clear_tx_cmd_buff(&tx_cmd_buff);
+  boot_record_mark(BOOT_MARK_BLR_READY);
   in_bootloader = 1;
-  app_jump_pending = 0;
+  app_jump_pending = APP_JUMP_NONE;
+  uart_baud_pending = 0;
+  TRACE1(TRACE_EVENT_BOOT, in_bootloader);
+  init_auto_boot();                            // Open the auto-boot window
 
   // Bootloader loop
   while(1) {
     if(!app_jump_pending) {
       rx_usart1(&rx_cmd_buff);                 // Collect command bytes
+      baud_usart1(&rx_cmd_buff, &tx_cmd_buff); // Baud change and fallback
+      auto_boot(&rx_cmd_buff);                 // Jump if no command in time
       reply(&rx_cmd_buff, &tx_cmd_buff);       // Command reply logic
       tx_usart1(&tx_cmd_buff);                 // Send a response if any
-    } else if(bl_check_app()) {                // Jump triggered; do basic check
-      while(!tx_cmd_buff.empty) {              // If jumping to user app,
-        tx_usart1(&tx_cmd_buff);               // finish sending response if any
-      }
-      for(size_t i=0; i<4000000; i++) {        // Wait for UART TX FIFO to flush
-        __asm__ volatile("nop");
-      }
-      app_jump_pending = 0;                    // Housekeeping
+      sleep_usart1(&rx_cmd_buff,&tx_cmd_buff); // Sleep until next interrupt
+    } else if(bl_check_app(app_jump_pending)) { // Jump triggered; basic check
+      int jump_target = app_jump_pending;      // Flash slot or QSPI flash
+      boot_record_mark(BOOT_MARK_JUMP_CMD);    // Start boot-to-app timer
+      drain_usart1(&tx_cmd_buff);              // Send response; wait for TC
+      app_jump_pending = APP_JUMP_NONE;        // Housekeeping
       in_bootloader = 0;
-      bl_jump_to_app();                        // Jump
+      TRACE1(TRACE_EVENT_JUMP, bl_app_addr(jump_target));
+      trace_flush();                           // Send remaining trace records
+      trace_stop();                            // Reset trace UART and DMA
+      timebase_stop();                         // Reset TIM2
+      boot_record_mark(BOOT_MARK_JUMP);
+      bl_jump_to_app(jump_target);             // Jump
     } else {                                   // If app_jump_pending &&
-      app_jump_pending = 0;                    //  !bl_check_app()
+      app_jump_pending = APP_JUMP_NONE;        //  !bl_check_app()
     }                                          // Something wrong, abort jump
   }
 
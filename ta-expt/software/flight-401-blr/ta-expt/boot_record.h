@@ -0,0 +1,86 @@
+// boot_record.h
+// Tartan Artibeus EXPT board boot record header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef BOOT_RECORD_H
+#define BOOT_RECORD_H
+
+// Standard library
+#include <stdint.h> // uint32_t
+
+// Macros
+
+//// Boot record location; the last 1 KB of SRAM2, which the linker script does
+//// not use and the startup code does not clear, so it survives the jump
+#define BOOT_RECORD_ADDR    ((uint32_t)0x1000fc00U)
+
+//// Boot record identification; bump the version whenever the layout changes
+#define BOOT_RECORD_MAGIC   ((uint32_t)0x544f4f42U) // "BOOT", LSB first
+#define BOOT_RECORD_VERSION ((uint32_t)2)
+
+// Typedefs
+
+//// Boot milestones; each is stamped with the DWT cycle counter, which is
+//// zeroed by init_boot_record and keeps counting across the jump from the
+//// bootloader to the application. Cycles before init_clock are at the reset
+//// clock (4 MHz MSI), not 80 MHz
+typedef enum boot_mark {
+  BOOT_MARK_BLR_START = 0,  // First line of the bootloader main
+  BOOT_MARK_BLR_CLOCK = 1,  // Bootloader init_clock done
+  BOOT_MARK_BLR_UART  = 2,  // Bootloader init_uart done
+  BOOT_MARK_BLR_RTC   = 3,  // Bootloader init_rtc done
+  BOOT_MARK_BLR_INIT  = 4,  // Remaining bootloader init functions done
+  BOOT_MARK_BLR_READY = 5,  // Bootloader command buffers cleared
+  BOOT_MARK_JUMP_CMD  = 6,  // Bootloader main loop saw BOOTLOADER_JUMP
+  BOOT_MARK_JUMP      = 7,  // Reply sent and peripherals reset; jumping now
+  BOOT_MARK_APP_START = 8,  // First line of the application main
+  BOOT_MARK_APP_CLOCK = 9,  // Application init_clock done
+  BOOT_MARK_APP_UART  = 10, // Application init_uart done
+  BOOT_MARK_APP_RTC   = 11, // Application init_rtc done
+  BOOT_MARK_APP_INIT  = 12, // Remaining application init functions done
+  BOOT_MARK_APP_READY = 13, // Application command buffers cleared
+  BOOT_MARK_COUNT     = 14  // Number of milestones
+} boot_mark_t;
+
+//// Boot record
+typedef struct boot_record {
+  uint32_t magic;                  // BOOT_RECORD_MAGIC if valid
+  uint32_t version;                // BOOT_RECORD_VERSION if valid
+  uint32_t marks[BOOT_MARK_COUNT]; // Cycle count per milestone; 0 if unset
+} boot_record_t;
+
+// Boot record functions
+
+/*  void init_boot_record(void)
+ *    Starts the DWT cycle counter from zero, clears all milestones, marks the
+ *    record valid and stamps BOOT_MARK_BLR_START; called first thing by the
+ *    bootloader
+ */
+void init_boot_record(void);
+
+/*  int boot_record_valid(void)
+ *  Return:
+ *    0 to indicate the record was not written by a compatible bootloader
+ *    Non-zero to indicate the record is valid
+ */
+int boot_record_valid(void);
+
+/*  void boot_record_mark(const boot_mark_t mark)
+ *    mark: milestone to stamp with the current DWT cycle count; ignored if the
+ *          record is not valid
+ */
+void boot_record_mark(const boot_mark_t mark);
+
+/*  uint32_t boot_record_cycles(const boot_mark_t from, const boot_mark_t to)
+ *    from: earlier milestone
+ *    to:   later milestone
+ *  Return:
+ *    Cycles elapsed between the two milestones, or 0 if either is unset
+ */
+uint32_t boot_record_cycles(const boot_mark_t from, const boot_mark_t to);
+
+#endif
@@ -7,24 +7,66 @@
 // See the top-level LICENSE file for the license.
 
 // Standard library
+#include <stddef.h>                 // size_t
 #include <stdint.h>                 // uint8_t
 
 // libopencm3 library
+#include <libopencm3/cm3/cortex.h>  // used in sleep_usart1
+#include <libopencm3/cm3/nvic.h>    // used in init_uart, bl_jump_to_app
 #include <libopencm3/cm3/scb.h>     // SCB_VTOR
-#include <libopencm3/stm32/flash.h> // used in init_clock
+#include <libopencm3/stm32/flash.h> // used in init_clock, bl_remap_and_jump
 #include <libopencm3/stm32/gpio.h>  // used in init_gpio
+#include <libopencm3/stm32/iwdg.h>  // used in bl_jump_to_app
 #include <libopencm3/stm32/pwr.h>   // used in set_rtc
 #include <libopencm3/stm32/rcc.h>   // used in init_clock, init_rtc
 #include <libopencm3/stm32/rtc.h>   // used in rtc functions
+#include <libopencm3/stm32/syscfg.h> // used in bl_remap_and_jump
 #include <libopencm3/stm32/usart.h> // used in init_uart
 
 // ta-expt library
 #include <bootloader.h>             // Header file
+#include <handoff.h>                // used in bl_jump_to_app
+#include <qspi.h>                   // used in bl_check_app, bl_jump_to_app
+#include <slots.h>                  // used in bl_check_app, bl_jump_to_app
 #include <taolst_protocol.h>        // TAOLST protocol macros, typedefs, fnctns
+#include <timebase.h>               // used in baud_usart1, auto_boot
+#include <trace.h>                  // TRACE0, TRACE1, TRACE2
 
 // Variables
 int rtc_set = 0; // Boolean; Zero until RTC date and time have been set
 
+//// USART1 baud rate state; see baud_usart1
+uint32_t uart_baud = UART_BAUD_DEFAULT; // Current USART1 baud rate
+int uart_baud_unconfirmed = 0;          // Boolean; Non-zero until valid cmd
+uint64_t uart_baud_changed = 0;         // Cycle count at last baud change
+extern uint32_t uart_baud_pending;      // Set by write_reply; 0 if none
+
+//// USART1 RX ring buffer; usart1_isr writes head, rx_usart1 writes tail
+volatile uint8_t rx_ring[RX_RING_SIZE];
+volatile size_t rx_ring_head = 0; // Index of next byte to be written
+volatile size_t rx_ring_tail = 0; // Index of next byte to be read
+
+//// Auto-boot window state; see auto_boot
+int auto_boot_armed = 0;       // Boolean; Non-zero while the window is open
+uint64_t auto_boot_opened = 0; // Cycle count when the window opened
+int auto_boot_partial = 0;     // Boolean; last window ended mid-command
+
+//// Sleep-on-idle state
+extern int app_jump_pending; // Never sleep with a jump pending
+sleep_stats_t sleep_stats = {
+ .sleep_count       = 0,
+ .wake_latency_last = 0,
+ .wake_latency_max  = 0
+};
+int sleep_woke = 0;         // Boolean; Non-zero until first byte after wake
+uint64_t sleep_wake_cycles; // Cycle count at the end of the last WFI
+
+//// Baud rates accepted by COMMON_SET_BAUD; USART1 runs from the 80 MHz APB2
+//// clock with 16x oversampling, so 5 Mbaud is the hardware limit
+static const uint32_t UART_BAUD_SUPPORTED[] = {
+ 115200, 230400, 460800, 921600, 1000000, 2000000, 4000000
+};
+
 // Initialization functions
 
 void init_clock(void) {
@@ -70,13 +112,19 @@ void init_uart(void) {
   gpio_mode_setup(GPIOA,GPIO_MODE_AF,GPIO_PUPD_NONE,GPIO9|GPIO10);
   gpio_set_af(GPIOA,GPIO_AF7,GPIO9);  // USART1_TX is alternate function 7
   gpio_set_af(GPIOA,GPIO_AF7,GPIO10); // USART1_RX is alternate function 7
-  usart_set_baudrate(USART1,115200);
+  usart_set_baudrate(USART1,UART_BAUD_DEFAULT);
   usart_set_databits(USART1,8);
   usart_set_stopbits(USART1,USART_STOPBITS_1);
   usart_set_mode(USART1,USART_MODE_TX_RX);
   usart_set_parity(USART1,USART_PARITY_NONE);
   usart_set_flow_control(USART1,USART_FLOWCONTROL_NONE);
   usart_enable(USART1);
+  uart_baud = UART_BAUD_DEFAULT;
+  uart_baud_unconfirmed = 0;
+  rx_ring_head = 0;
+  rx_ring_tail = 0;
+  usart_enable_rx_interrupt(USART1);  // RX bytes go to rx_ring via usart1_isr
+  nvic_enable_irq(NVIC_USART1_IRQ);   // RX interrupt also wakes sleep_usart1
 }
 
 void init_rtc(void) {
@@ -88,11 +136,60 @@ void init_rtc(void) {
   rcc_enable_rtc_clock();            // Enable RTC
   rtc_wait_for_synchro();
   pwr_enable_backup_domain_write_protect();
-  rtc_set = 0;                       // RTC date and time has not yet been set
+  // The RTC keeps running through a reset; it has been set if the backup
+  // domain holds a calendar (INITS) and the prescaler set_rtc programs,
+  // not the reset value
+  rtc_set =
+   (RTC_ISR&RTC_ISR_INITS)!=0 && ((RTC_PRER>>16)&0x7f)==RTC_PREDIV_A;
+}
+
+void init_auto_boot(void) {
+  auto_boot_armed = (AUTO_BOOT_WINDOW_MS>0);
+  auto_boot_opened = now_cycles();
+  auto_boot_partial = 0;
 }
 
 // Utility functions
 
+int uart_baud_supported(const uint32_t baud) {
+  size_t count = sizeof(UART_BAUD_SUPPORTED)/sizeof(UART_BAUD_SUPPORTED[0]);
+  for(size_t i=0; i<count; i++) {
+    if(UART_BAUD_SUPPORTED[i]==baud) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void set_uart_baud(const uint32_t baud) {
+  usart_disable(USART1);                         // BRR is written with UE==0
+  usart_set_baudrate(USART1,baud);
+  USART_ICR(USART1) = USART_ICR_ORECF|USART_ICR_FECF; // Drop stale errors
+  usart_enable(USART1);
+  uart_baud = baud;
+}
+
+//// Reads RTC_TR and RTC_DR together with the subsecond count of the same
+//// second; the shadow registers are bypassed, so the reads are retried until
+//// RTC_SSR stays put across them. A shift with RTC_SHIFTR_ADD1S can leave
+//// RTC_SSR above the prescaler, which puts the time in the second before the
+//// calendar one; back_o is then 1. Returns nanoseconds into the second
+static uint32_t read_rtc(uint32_t* tr_o, uint32_t* dr_o, uint32_t* back_o) {
+  uint32_t ss;
+  do {
+    ss = RTC_SSR;
+    *tr_o = RTC_TR;
+    *dr_o = RTC_DR;
+  } while(ss!=RTC_SSR);
+  uint32_t prediv_s = RTC_PRER&0x7fff;          // The application trims it
+  *back_o = 0;
+  if(ss>prediv_s) {
+    *back_o = 1;
+    ss -= prediv_s+1;
+  }
+  return (prediv_s-ss)*(1000000000/(prediv_s+1));
+}
+
 int set_rtc(const uint32_t sec, const uint32_t ns) {
   // sec and ns represent time since J2000
   //   J2000 UTC: 2000-01-01 11:58:55.816
@@ -142,12 +239,20 @@ int set_rtc(const uint32_t sec, const uint32_t ns) {
   uint8_t hour = (uint8_t)(remaining_sec/3600);
   uint8_t minute = (uint8_t)((remaining_sec%3600)/60);
   uint8_t second = (uint8_t)((remaining_sec%3600)%60);
+  // keep the synchronous prescaler the application trimmed to the measured
+  // LSI; RTC_PREDIV_S only if the RTC has not been set up with RTC_PREDIV_A
+  uint32_t prediv_s = RTC_PRER&0x7fff;
+  if(((RTC_PRER>>16)&0x7f)!=RTC_PREDIV_A) {
+    prediv_s = RTC_PREDIV_S;
+  }
+  // convert nanosecond into subsecond ticks
+  uint32_t ticks = nanosecond/(1000000000/(prediv_s+1));
   // set the RTC
   pwr_disable_backup_domain_write_protect();
   rtc_unlock();
   rtc_set_init_flag();
   rtc_wait_for_init_ready();
-  rtc_set_prescaler((uint32_t)249,(uint32_t)127);
+  rtc_set_prescaler(prediv_s,RTC_PREDIV_A);
   rtc_enable_bypass_shadow_register();
   rtc_calendar_set_year(year);
   rtc_calendar_set_month(month);
@@ -155,6 +260,14 @@ int set_rtc(const uint32_t sec, const uint32_t ns) {
   rtc_set_am_format();
   rtc_time_set_time(hour,minute,second,1);
   rtc_clear_init_flag();
+  // the calendar restarts at the top of the second; advance it by ticks with
+  // a one-second add and a (prediv_s+1-ticks) delay. RTC_SSR reads above
+  // prediv_s until it has counted the delay down, and read_rtc puts those
+  // readings in the second before
+  if(ticks>0) {
+    RTC_SHIFTR = RTC_SHIFTR_ADD1S|(prediv_s+1-ticks);
+    while(RTC_ISR & RTC_ISR_SHPF) {}
+  }
   rtc_lock();
   pwr_enable_backup_domain_write_protect();
   // record and return success
@@ -164,13 +277,17 @@ int set_rtc(const uint32_t sec, const uint32_t ns) {
 
 int get_rtc(uint32_t* sec, uint32_t* ns) {
   if(rtc_set) {
-    // Read all values "atomically"
-    int32_t year = (int32_t)(((RTC_DR>>20)*10)+((RTC_DR>>16)&0xf)+2000);
-    int32_t month = (int32_t)((((RTC_DR>>12)&0x1)*10)+((RTC_DR>>8)&0xf));
-    int32_t day = (int32_t)((((RTC_DR>>4)&0x3)*10)+(RTC_DR&0xf));
-    int32_t hour = (int32_t)((((RTC_TR>>20)&0x3)*10)+((RTC_TR>>16)&0xf));
-    int32_t minute = (int32_t)((((RTC_TR>>12)&0x7)*10)+((RTC_TR>>8)&0xf));
-    int32_t second = (int32_t)((((RTC_TR>>4)&0x7)*10)+(RTC_TR&0xf));
+    // Read all values coherently
+    uint32_t tr;
+    uint32_t dr;
+    uint32_t back;
+    uint32_t subsecond = read_rtc(&tr,&dr,&back);
+    int32_t year = (int32_t)(((dr>>20)*10)+((dr>>16)&0xf)+2000);
+    int32_t month = (int32_t)((((dr>>12)&0x1)*10)+((dr>>8)&0xf));
+    int32_t day = (int32_t)((((dr>>4)&0x3)*10)+(dr&0xf));
+    int32_t hour = (int32_t)((((tr>>20)&0x3)*10)+((tr>>16)&0xf));
+    int32_t minute = (int32_t)((((tr>>12)&0x7)*10)+((tr>>8)&0xf));
+    int32_t second = (int32_t)((((tr>>4)&0x7)*10)+(tr&0xf));
     // Calculate JD from year, month, day
     int32_t jd =
      day-32075+1461*(year+4800+(month-14)/12)/4
@@ -178,52 +295,221 @@ int get_rtc(uint32_t* sec, uint32_t* ns) {
      *((year+4900+(month-14)/12)/100)/4;
     // Convert into seconds since 2000-01-01 11:58:56
     *sec = (uint32_t)(86400*(jd-2451545)+60*(60*hour+minute)+second-43136);
-    // Write nanoseconds
-    *ns = (uint32_t)(184000000);
+    *sec -= back;
+    // Write nanoseconds, carrying into sec past the end of the second
+    *ns = (uint32_t)(184000000)+subsecond;
+    if(*ns>=1000000000) {
+      *sec += 1;
+      *ns -= 1000000000;
+    }
   }
   return rtc_set;
 }
 
 // Bootloader functions
 
-int bl_check_app(void) {
+//// Runs from RAM (.ramtext is copied with .data by the startup code), since
+//// the flash it was fetched from is remapped: maps the bank holding the
+//// chosen slot at 0x08000000, flushes the flash caches, and starts the image
+//// at addr
+__attribute__((section(".ramtext"), noinline))
+static void bl_remap_and_jump(const uint32_t swap, const uint32_t addr) {
+  uint32_t caches = FLASH_ACR & (FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+  if(swap) {
+    SYSCFG_MEMRMP |= SYSCFG_MEMRMP_FB_MODE;
+  } else {
+    SYSCFG_MEMRMP &= ~SYSCFG_MEMRMP_FB_MODE;
+  }
+  __asm__ volatile("dsb\n isb" ::: "memory");
+  FLASH_ACR &= ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);  // Caches hold old bank
+  FLASH_ACR |= (FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+  FLASH_ACR &= ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+  FLASH_ACR |= caches;
+  // Set the vector table
+  SCB_VTOR = addr;
+  // Set the master stack pointer and jump; the first 4 bytes hold the stack
+  // address, so the jump address is after that
+  __asm__ volatile(
+   "msr msp, %0\n"
+   "bx %1\n"
+   :: "r" (MMIO32(addr)), "r" (MMIO32(addr+((uint32_t)0x00000004U)))
+  );
+}
+
+uint32_t bl_app_addr(const int target) {
+  return (target==APP_JUMP_XIP) ? QSPI_XIP_ADDR : APP_ADDR;
+}
+
+int bl_check_app(const int target) {
   // Does the first four bytes of the application represent the initialization
   // location of a stack pointer within the boundaries of the RAM?
-  return (((*(uint32_t*)APP_ADDR)-SRAM1_BASE) <= SRAM1_SIZE);
+  uint32_t addr = QSPI_XIP_ADDR;
+  if(target==APP_JUMP_XIP) {
+    init_qspi();                      // Map the QSPI flash to read its vectors
+    qspi_memory_mapped();
+  } else {
+    slot_state_t state = slot_read_state();
+    addr = slot_addr(slot_boot_target(&state));
+  }
+  return (((*(uint32_t*)addr)-SRAM1_BASE) <= SRAM1_SIZE);
 }
 
-void bl_jump_to_app(void) {
-  // The first 4 bytes hold the stack address, so jump address is after that
-  uint32_t jump_addr =
-   *(volatile uint32_t*)(APP_ADDR+((uint32_t)0x00000004U));
-  // Create a jump() function
-  void (*jump)(void) = (void (*)(void))jump_addr;
-  // Set the vector table
-  SCB_VTOR = APP_ADDR;
-  // Set the master stack pointer
-  __asm__ volatile("msr msp, %0"::"g" (*(volatile uint32_t*)APP_ADDR));
-  // Jump to the application
-  jump();
+int bl_verify_app(void) {
+  return slot_verify_boot_target(APP_MAX_PAGES*BYTES_PER_PAGE);
+}
+
+void bl_jump_to_app(const int target) {
+  // Count a trial boot before starting it, so a trial image that never gets
+  // to confirm itself is abandoned on the next boot, and start the IWDG so
+  // one that hangs gets there; a trial boot that cannot be counted is not
+  // started. An image in QSPI flash is outside the slots and leaves their
+  // log alone
+  slot_state_t state = slot_read_state();
+  slot_t slot = slot_boot_target(&state);
+  if(target==APP_JUMP_XIP) {
+    slot = SLOT_A;
+  } else if(slot==state.trial) {
+    if(slot_append(SLOT_RECORD_BOOT, slot, 0, 0)) {
+      iwdg_set_period_ms(SLOT_TRIAL_WDG_MS);        // Only a reset stops it
+      iwdg_start();
+    } else {
+      TRACE2(TRACE_EVENT_SLOT_FAIL, SLOT_RECORD_BOOT, slot);
+      slot = state.active;
+    }
+  }
+  // Hand USART1 over running, with the bytes that arrived after the command;
+  // only its interrupt is returned to reset state
+  nvic_disable_irq(NVIC_USART1_IRQ);
+  usart_disable_rx_interrupt(USART1);
+  nvic_clear_pending_irq(NVIC_USART1_IRQ);
+  handoff_t* handoff = handoff_begin();
+  handoff->flags =
+   HANDOFF_FLAG_CLOCK | HANDOFF_FLAG_UART | HANDOFF_FLAG_RTC |
+   (rtc_set ? HANDOFF_FLAG_RTC_SET : 0) |
+   ((target==APP_JUMP_XIP) ? HANDOFF_FLAG_QSPI : 0);
+  handoff->uart_baud = uart_baud;
+  while(rx_ring_tail!=rx_ring_head && handoff->rx_len<HANDOFF_RX_MAX) {
+    handoff->rx[handoff->rx_len] = rx_ring[rx_ring_tail];
+    handoff->rx_len += 1;
+    rx_ring_tail = (rx_ring_tail+1)&(RX_RING_SIZE-1);
+  }
+  handoff_commit();
+  // Map the slot at APP_ADDR, or leave bank 1 mapped for QSPI flash, and jump
+  rcc_periph_clock_enable(RCC_SYSCFG);
+  bl_remap_and_jump(slot==SLOT_B, bl_app_addr(target));
+}
+
+// Interrupt service routines
+
+void usart1_isr(void) {
+  while(usart_get_flag(USART1,USART_ISR_RXNE)) {     // Drain RX data register
+    uint8_t b = usart_recv(USART1);                  // Receive byte from RX pin
+    size_t next = (rx_ring_head+1)&(RX_RING_SIZE-1); //
+    if(next!=rx_ring_tail) {                         // Drop byte if ring full
+      rx_ring[rx_ring_head] = b;                     //
+      rx_ring_head = next;                           //
+    }                                                //
+  }                                                  //
+  USART_ICR(USART1) = USART_ICR_ORECF;               // ORE also raises the IRQ
 }
 
 // Task-like functions
 
 void rx_usart1(rx_cmd_buff_t* rx_cmd_buff_o) {
   while(                                             // while
-   usart_get_flag(USART1,USART_ISR_RXNE) &&          //  USART1 RX not empty AND
+   rx_ring_tail!=rx_ring_head &&                     //  RX ring not empty AND
    rx_cmd_buff_o->state!=RX_CMD_BUFF_STATE_COMPLETE  //  Command not complete
   ) {                                                //
-    uint8_t b = usart_recv(USART1);                  // Receive byte from RX pin
+    if(sleep_woke) {                                 // First byte after wake
+      uint32_t latency = (uint32_t)(now_cycles()-sleep_wake_cycles);
+      sleep_stats.wake_latency_last = latency;       //
+      if(latency>sleep_stats.wake_latency_max) {     //
+        sleep_stats.wake_latency_max = latency;      //
+      }                                              //
+      sleep_woke = 0;                                //
+    }                                                //
+    uint8_t b = rx_ring[rx_ring_tail];               // Pop byte from RX ring
+    rx_ring_tail = (rx_ring_tail+1)&(RX_RING_SIZE-1);//
     push_rx_cmd_buff(rx_cmd_buff_o, b);              // Push byte to buffer
   }                                                  //
 }
 
+void baud_usart1(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
+  if(                                                // if
+   uart_baud_pending &&                              //  Baud change pending AND
+   tx_cmd_buff_o->empty &&                           //  TX buffer empty AND
+   usart_get_flag(USART1,USART_ISR_TC)               //  Last ACK bit sent
+  ) {                                                //
+    set_uart_baud(uart_baud_pending);                // Switch baud rate
+    TRACE1(TRACE_EVENT_BAUD, uart_baud_pending);     //
+    uart_baud_pending = 0;                           //
+    uart_baud_unconfirmed = (uart_baud!=UART_BAUD_DEFAULT);
+    uart_baud_changed = now_cycles();                // Start fallback timer
+    clear_rx_cmd_buff(rx_cmd_buff_o);                // Drop partial command
+  } else if(uart_baud_unconfirmed) {                 // Waiting on new baud
+    if(rx_cmd_buff_o->state==RX_CMD_BUFF_STATE_COMPLETE) {
+      uart_baud_unconfirmed = 0;                     // Valid cmd; keep baud
+    } else if(                                       // No valid cmd in time
+     now_cycles()-uart_baud_changed >
+     cycles_from_ms(UART_BAUD_TIMEOUT_MS)
+    ) {                                              //
+      TRACE1(TRACE_EVENT_BAUD_FALLBACK, uart_baud);  //
+      set_uart_baud(UART_BAUD_DEFAULT);              // Fall back
+      uart_baud_unconfirmed = 0;                     //
+      clear_rx_cmd_buff(rx_cmd_buff_o);              // Drop garbled bytes
+    }                                                //
+  }                                                  //
+}
+
+void auto_boot(rx_cmd_buff_t* rx_cmd_buff_o) {
+  if(auto_boot_armed) {                              // Window open
+    if(rx_cmd_buff_o->state==RX_CMD_BUFF_STATE_COMPLETE) {
+      auto_boot_armed = 0;                           // Command; stay for more
+    } else if(                                       // No command in time
+     now_cycles()-auto_boot_opened >
+     cycles_from_ms(AUTO_BOOT_WINDOW_MS)
+    ) {                                              //
+      auto_boot_opened = now_cycles();               // Retry unless it boots
+      if(                                            // if
+       rx_cmd_buff_o->state!=RX_CMD_BUFF_STATE_START_BYTE_0 || // Partial OR
+       rx_ring_tail!=rx_ring_head                    //  RX ring not empty
+      ) {                                            //
+        if(auto_boot_partial) {                      // Two windows with no
+          clear_rx_cmd_buff(rx_cmd_buff_o);          //  command: noise, drop
+          auto_boot_partial = 0;                     //  it and try again
+        } else {                                     //
+          auto_boot_partial = 1;                     // May still complete
+        }                                            //
+      } else if(                                     // else if
+       bl_check_app(APP_JUMP_SLOT) &&                //  Stack pointer OK AND
+       bl_verify_app()                               //  Image digest matches
+      ) {                                            //
+        auto_boot_armed = 0;                         //
+        app_jump_pending = APP_JUMP_SLOT;            // Jump as if commanded
+      } else {                                       // Nothing to boot; stay
+        auto_boot_armed = 0;                         //
+      }                                              //
+    }                                                //
+  }                                                  //
+}
+
 void reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
   if(                                                  // if
    rx_cmd_buff_o->state==RX_CMD_BUFF_STATE_COMPLETE && // rx_cmd is valid AND
    tx_cmd_buff_o->empty                                // tx_cmd is empty
   ) {                                                  //
+    TRACE2(                                            // Command received
+     TRACE_EVENT_CMD, rx_cmd_buff_o->data[OPCODE_INDEX],
+     (rx_cmd_buff_o->data[MSG_ID_MSB_INDEX]<<8) |
+     rx_cmd_buff_o->data[MSG_ID_LSB_INDEX]
+    );                                                 //
     write_reply(rx_cmd_buff_o, tx_cmd_buff_o);         // execute cmd and reply
+    if(!(tx_cmd_buff_o->empty)) {                      // Reply queued
+      TRACE2(
+       TRACE_EVENT_REPLY, tx_cmd_buff_o->data[OPCODE_INDEX],
+       tx_cmd_buff_o->data[MSG_LEN_INDEX]
+      );
+    }                                                  //
   }                                                    //
 }
 
@@ -236,3 +522,38 @@ void tx_usart1(tx_cmd_buff_t* tx_cmd_buff_o) {
     usart_send(USART1,b);                            // Send byte to TX pin
   }                                                  //
 }
+
+void drain_usart1(tx_cmd_buff_t* tx_cmd_buff_o) {
+  while(!(tx_cmd_buff_o->empty)) {                   // Send the rest of reply
+    tx_usart1(tx_cmd_buff_o);                        //
+  }                                                  //
+  while(!usart_get_flag(USART1,USART_ISR_TC)) {}     // Last stop bit sent
+}
+
+void sleep_usart1(
+ const rx_cmd_buff_t* rx_cmd_buff_o, const tx_cmd_buff_t* tx_cmd_buff_o
+) {
+  // Nothing wakes the core when a timeout expires, so stay awake while a
+  // timer runs
+  cm_disable_interrupts();                           // Pending IRQ still wakes
+  if(                                                // if
+   rx_ring_tail==rx_ring_head &&                     //  RX ring empty AND
+   rx_cmd_buff_o->state!=RX_CMD_BUFF_STATE_COMPLETE && // No cmd to reply to AND
+   tx_cmd_buff_o->empty &&                           //  TX buffer empty AND
+   !uart_baud_pending &&                             //  No baud change AND
+   !uart_baud_unconfirmed &&                         //  No fallback timer AND
+   !auto_boot_armed &&                               //  No auto-boot timer AND
+   !app_jump_pending                                 //  No jump pending
+  ) {                                                //
+    __asm__ volatile("wfi");                         // Sleep until interrupt
+    sleep_wake_cycles = now_cycles();                //
+    cm_enable_interrupts();                          // Run the waking ISR
+    if(rx_ring_tail!=rx_ring_head) {                 // Woken by USART1 RX
+      sleep_stats.sleep_count += 1;                  //
+      TRACE0(TRACE_EVENT_WAKE);                      //
+      sleep_woke = 1;                                //
+    }                                                //
+  } else {                                           //
+    cm_enable_interrupts();                          //
+  }                                                  //
+}
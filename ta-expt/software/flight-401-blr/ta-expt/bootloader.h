@@ -17,24 +17,73 @@
 //// Application start address
 #define APP_ADDR   ((uint32_t)0x08008000U)
 
+//// Application flash pages; subpage IDs 0x00 to 0xff span the 16 pages from
+//// APP_ADDR (page 16 of the slot's bank) through the start of page 32
+#define APP_MAX_PAGES ((uint32_t)16)
+
 //// SRAM1 start address
 #define SRAM1_BASE ((uint32_t)0x20000000U)
 
 //// SRAM1 size
 #define SRAM1_SIZE ((uint32_t)0x00040000U)
 
+//// USART1 baud rate after reset and after an unconfirmed baud rate change
+#define UART_BAUD_DEFAULT    ((uint32_t)115200U)
+
+//// Time allowed at a new baud rate for a valid command to arrive
+#define UART_BAUD_TIMEOUT_MS ((uint32_t)2000U)
+
+//// USART1 RX ring buffer size; must be a power of two
+#define RX_RING_SIZE ((size_t)512)
+
+//// RTC prescalers for the 32 kHz LSI: 32 kHz/(31+1) = 1 kHz subsecond ticks,
+//// 1 kHz/(999+1) = 1 Hz calendar; set_rtc keeps the RTC_PREDIV_S the
+//// application trimmed to the LSI, if any
+#define RTC_PREDIV_A ((uint32_t)31)
+#define RTC_PREDIV_S ((uint32_t)999)
+
+//// Time after reset for a command to arrive before the bootloader starts the
+//// application on its own (if it checks out); 0 waits for BOOTLOADER_JUMP
+#define AUTO_BOOT_WINDOW_MS  ((uint32_t)500U)
+
+// Typedefs
+
+//// sleep-on-idle statistics; wake latency is in CPU cycles from the end of
+//// WFI to the first byte handed to push_rx_cmd_buff
+typedef struct sleep_stats {
+  uint32_t sleep_count;       // Number of WFI sleeps that ended on USART1 RX
+  uint32_t wake_latency_last; // Wake-to-first-byte latency of the last wake
+  uint32_t wake_latency_max;  // Largest wake-to-first-byte latency seen
+} sleep_stats_t;
+
 // Initialization functions
 
 void init_clock(void);
 void init_led(void);
 void init_uart(void);
 void init_rtc(void);
+void init_auto_boot(void);
 
 // Utility functions
 
+/*  int uart_baud_supported(const uint32_t baud)
+ *    baud: requested USART1 baud rate
+ *  Return:
+ *    0 to indicate baud is not supported
+ *    Non-zero to indicate baud is supported
+ */
+int uart_baud_supported(const uint32_t baud);
+
+/*  void set_uart_baud(const uint32_t baud)
+ *    baud: new USART1 baud rate; any byte still in the TX FIFO is lost, so
+ *          wait for USART_ISR_TC first
+ */
+void set_uart_baud(const uint32_t baud);
+
 /*  int set_rtc(const int32_t sec, const int32_t ns)
  *    sec: seconds since J2000
- *    ns:  any additional nanoseconds
+ *    ns:  any additional nanoseconds, kept to the RTC subsecond resolution;
+ *         waits up to one second for RTC_SSR to allow the subsecond shift
  *  Return:
  *    0 to indicate failure
  *    Non-zero to indicate success
@@ -52,13 +101,49 @@ int get_rtc(uint32_t* sec, uint32_t* ns);
 
 // Bootloader functions
 
-int bl_check_app(void);
-void bl_jump_to_app(void);
+/*  uint32_t bl_app_addr(const int target)
+ *    target: APP_JUMP_SLOT or APP_JUMP_XIP
+ *  Return:
+ *    Address of the vector table the jump to target starts from
+ */
+uint32_t bl_app_addr(const int target);
+
+/*  int bl_check_app(const int target)
+ *    target: APP_JUMP_SLOT or APP_JUMP_XIP; the latter maps the QSPI flash
+ *  Return:
+ *    Non-zero if the slot chosen by slot_boot_target, or the QSPI flash,
+ *    starts with a stack pointer inside SRAM1
+ */
+int bl_check_app(const int target);
+
+/*  int bl_verify_app(void)
+ *  Return:
+ *    Non-zero if the image in the slot chosen by slot_boot_target matches the
+ *    length and CRC-32 recorded when it was selected; see slot_boot_digest
+ */
+int bl_verify_app(void);
+
+/*  void bl_jump_to_app(const int target)
+ *    target: APP_JUMP_SLOT or APP_JUMP_XIP; bl_check_app(target) must have
+ *            passed
+ *    Records a trial boot if needed, disables the USART1 interrupt, fills in
+ *    the handoff block (clock, USART1 baud, RTC state, pending RX bytes), maps
+ *    the slot chosen by slot_boot_target at APP_ADDR and jumps to it, or to
+ *    the image at QSPI_XIP_ADDR; drain_usart1 first so the reply to
+ *    BOOTLOADER_JUMP is not cut off
+ */
+void bl_jump_to_app(const int target);
 
 // Task-like functions
 
 void rx_usart1(rx_cmd_buff_t* rx_cmd_buff_o);
+void baud_usart1(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o);
+void auto_boot(rx_cmd_buff_t* rx_cmd_buff_o);
 void reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o);
 void tx_usart1(tx_cmd_buff_t* tx_cmd_buff_o);
+void drain_usart1(tx_cmd_buff_t* tx_cmd_buff_o);
+void sleep_usart1(
+ const rx_cmd_buff_t* rx_cmd_buff_o, const tx_cmd_buff_t* tx_cmd_buff_o
+);
 
 #endif
@@ -0,0 +1,60 @@
+// crc32.c
+// Tartan Artibeus EXPT board CRC-32 implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                 // size_t
+#include <stdint.h>                 // uint8_t, uint32_t
+
+// libopencm3 library
+#include <libopencm3/stm32/crc.h>   // CRC registers
+#include <libopencm3/stm32/rcc.h>   // used in init_crc32
+
+// ta-expt library
+#include <crc32.h>                  // Header file
+
+// Helper functions
+
+//// Reverses the bit order of a word
+static uint32_t rbit(const uint32_t x) {
+  uint32_t y;
+  __asm__("rbit %0, %1" : "=r" (y) : "r" (x));
+  return y;
+}
+
+// Initialization functions
+
+void init_crc32(void) {
+  rcc_periph_clock_enable(RCC_CRC);
+  rcc_periph_reset_pulse(RST_CRC);          // 32-bit, polynomial 0x04c11db7
+  CRC_CR |= CRC_CR_REV_OUT;                 // Output is the reflected register
+}
+
+// CRC functions
+
+uint32_t crc32(const uint32_t crc, const uint8_t* data, const size_t len) {
+  // The CRC unit shifts MSB first, so the reflected state ~crc is loaded bit
+  // reversed and resumes exactly where the previous call stopped
+  CRC_INIT = rbit(~crc);
+  CRC_CR |= CRC_CR_RESET;
+  size_t i = 0;
+  // Whole words: reversing all 32 input bits puts the first byte first
+  CRC_CR = (CRC_CR & ~(CRC_CR_REV_IN_MASK<<CRC_CR_REV_IN_SHIFT)) |
+           (CRC_CR_REV_IN_WORD<<CRC_CR_REV_IN_SHIFT);
+  for(; i+4<=len; i+=4) {
+    CRC_DR =
+     ((uint32_t)(data[i+3])<<24) | ((uint32_t)(data[i+2])<<16) |
+     ((uint32_t)(data[i+1])<< 8) | ((uint32_t)(data[i+0])<< 0);
+  }
+  // Remaining bytes
+  CRC_CR = (CRC_CR & ~(CRC_CR_REV_IN_MASK<<CRC_CR_REV_IN_SHIFT)) |
+           (CRC_CR_REV_IN_BYTE<<CRC_CR_REV_IN_SHIFT);
+  for(; i<len; i++) {
+    MMIO8(&CRC_DR) = data[i];
+  }
+  return ~CRC_DR;
+}
@@ -0,0 +1,72 @@
+// handoff.h
+// Tartan Artibeus EXPT board handoff header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+// Standard library
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint32_t
+
+// Macros
+
+//// Handoff block location; the 1 KB of SRAM2 below the boot record, which the
+//// linker script does not use and the startup code does not clear
+#define HANDOFF_ADDR    ((uint32_t)0x1000f800U)
+
+//// Handoff block identification; bump the version whenever the layout changes
+#define HANDOFF_MAGIC   ((uint32_t)0x46444e48U) // "HNDF", LSB first
+#define HANDOFF_VERSION ((uint32_t)1)
+
+//// Pending USART1 RX bytes carried over to the application
+#define HANDOFF_RX_MAX  ((size_t)256)
+
+//// State the bootloader leaves set up for the application
+#define HANDOFF_FLAG_CLOCK   ((uint32_t)0x00000001U) // 80 MHz PLL is sysclk
+#define HANDOFF_FLAG_UART    ((uint32_t)0x00000002U) // USART1 on at uart_baud
+#define HANDOFF_FLAG_RTC     ((uint32_t)0x00000004U) // RTC clocked and synced
+#define HANDOFF_FLAG_RTC_SET ((uint32_t)0x00000008U) // RTC date and time set
+#define HANDOFF_FLAG_QSPI    ((uint32_t)0x00000010U) // QSPI flash mapped; XIP
+
+// Typedefs
+
+//// Handoff block
+typedef struct handoff {
+  uint32_t magic;              // HANDOFF_MAGIC if valid
+  uint32_t version;            // HANDOFF_VERSION if valid
+  uint32_t flags;              // HANDOFF_FLAG_*
+  uint32_t uart_baud;          // USART1 baud rate if HANDOFF_FLAG_UART
+  uint32_t rx_len;             // Number of valid bytes in rx
+  uint8_t  rx[HANDOFF_RX_MAX]; // USART1 bytes received but not yet handled
+} handoff_t;
+
+// Handoff functions
+
+/*  handoff_t* handoff_begin(void)
+ *    Invalidates the handoff block so it can be filled in; called by the
+ *    bootloader just before the jump
+ *  Return:
+ *    The handoff block
+ */
+handoff_t* handoff_begin(void);
+
+/*  void handoff_commit(void)
+ *    Marks the handoff block filled in since handoff_begin as valid
+ */
+void handoff_commit(void);
+
+/*  int handoff_take(handoff_t* handoff_o)
+ *    handoff_o: filled in with the handoff block if it is valid
+ *  Return:
+ *    0 to indicate there was no valid handoff block
+ *    Non-zero to indicate handoff_o holds it; the block is invalidated so it
+ *    is used once
+ */
+int handoff_take(handoff_t* handoff_o);
+
+#endif
@@ -0,0 +1,60 @@
+// qspi.c
+// Tartan Artibeus EXPT board QSPI flash execute-in-place implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stdint.h>                   // uint32_t
+
+// libopencm3 library
+#include <libopencm3/stm32/gpio.h>    // used in init_qspi
+#include <libopencm3/stm32/quadspi.h> // QUADSPI registers
+#include <libopencm3/stm32/rcc.h>     // used in init_qspi
+
+// ta-expt library
+#include <qspi.h>                     // Header file
+
+// Initialization functions
+
+void init_qspi(void) {
+  rcc_periph_clock_enable(RCC_QSPI);
+  rcc_periph_reset_pulse(RST_QSPI);
+  rcc_periph_clock_enable(RCC_GPIOA);
+  rcc_periph_clock_enable(RCC_GPIOC);
+  gpio_mode_setup(GPIOC,GPIO_MODE_AF,GPIO_PUPD_NONE,GPIO1|GPIO2|GPIO3|GPIO4);
+  gpio_mode_setup(GPIOC,GPIO_MODE_AF,GPIO_PUPD_PULLUP,GPIO11);
+  gpio_mode_setup(GPIOA,GPIO_MODE_AF,GPIO_PUPD_NONE,GPIO3);
+  gpio_set_af(GPIOC,GPIO_AF10,GPIO1|GPIO2|GPIO3|GPIO4); // IO0 through IO3
+  gpio_set_af(GPIOC,GPIO_AF10,GPIO11);                  // BK2_NCS
+  gpio_set_af(GPIOA,GPIO_AF10,GPIO3);                   // CLK
+  gpio_set_output_options(
+   GPIOC,GPIO_OTYPE_PP,GPIO_OSPEED_VERYHIGH,GPIO1|GPIO2|GPIO3|GPIO4|GPIO11
+  );
+  gpio_set_output_options(GPIOA,GPIO_OTYPE_PP,GPIO_OSPEED_VERYHIGH,GPIO3);
+  while(QUADSPI_SR & QUADSPI_SR_BUSY) {}
+  QUADSPI_DCR =
+   (((uint32_t)0x17) << 16) |  // FSIZE: 2^(23+1) bytes = 16 MB
+   (((uint32_t)0x01) <<  8);   // CSHT: 2 cycles; CKMODE 0
+  QUADSPI_CR =
+   (((uint32_t)0x09) << 24) |  // PRESCALER: 80 MHz/10 = 8 MHz
+   (((uint32_t)0x03) <<  8) |  // FTHRES: 4 bytes
+   (((uint32_t)0x01) <<  7) |  // FSEL: flash 2
+   ((uint32_t)0x01);           // EN
+}
+
+// QSPI functions
+
+void qspi_memory_mapped(void) {
+  while(QUADSPI_SR & QUADSPI_SR_BUSY) {}
+  QUADSPI_CCR =
+   (QUADSPI_CCR_FMODE_MEMMAP  << QUADSPI_CCR_FMODE_SHIFT)  |
+   (QUADSPI_CCR_MODE_4LINE    << QUADSPI_CCR_DMODE_SHIFT)  |
+   (QSPI_READ_DUMMY_CYCLES    << QUADSPI_CCR_DCYC_SHIFT)   |
+   (((uint32_t)0x02)          << QUADSPI_CCR_ADSIZE_SHIFT) | // 24-bit address
+   (QUADSPI_CCR_MODE_1LINE    << QUADSPI_CCR_ADMODE_SHIFT) |
+   (QUADSPI_CCR_MODE_1LINE    << QUADSPI_CCR_IMODE_SHIFT)  |
+   (QSPI_CMD_READ_QUAD_OUT    << QUADSPI_CCR_INST_SHIFT);
+}
@@ -0,0 +1,245 @@
+// slots.c
+// Tartan Artibeus EXPT board A/B application slot implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                  // size_t
+#include <stdint.h>                  // uint8_t, uint32_t, uint64_t
+
+// libopencm3 library
+#include <libopencm3/stm32/flash.h>  // used in slot_erase_page, slot_append,
+                                     //  slot_program_log
+#include <libopencm3/stm32/syscfg.h> // used in slot_mapped
+
+// ta-expt library
+#include <crc32.h>                   // Seals log records, checks images
+#include <slots.h>                   // Header file
+
+// Helper functions
+
+//// Address of the slot log in the current memory map
+static uint32_t slot_log_addr(void) {
+  uint32_t bank1 = (slot_mapped()==SLOT_B) ? SLOT_BANK_SIZE : 0;
+  return SLOT_FLASH_BASE+bank1+SLOT_LOG_OFFSET;
+}
+
+//// Seal over the first 12 bytes of a record
+static uint32_t slot_seal(const slot_record_t* record) {
+  return crc32(0, (const uint8_t*)record, sizeof(slot_record_t)-4);
+}
+
+//// Non-zero if the record at index holds a valid sealed record
+static int slot_read_record(const uint32_t index, slot_record_t* record_o) {
+  const slot_record_t* src =
+   (const slot_record_t*)(slot_log_addr()+index*sizeof(slot_record_t));
+  *record_o = *src;
+  return
+   record_o->magic==SLOT_RECORD_MAGIC &&
+   (record_o->slot==SLOT_A || record_o->slot==SLOT_B) &&
+   record_o->seal==slot_seal(record_o);
+}
+
+//// Programs a record at index; flash must be unlocked
+static int slot_program_record(
+ const uint32_t index, const uint8_t type, const slot_t slot,
+ const uint32_t image_len, const uint32_t image_crc
+) {
+  slot_record_t record = {
+   .magic     = SLOT_RECORD_MAGIC,
+   .type      = type,
+   .slot      = (uint8_t)slot,
+   .reserved  = 0xff,
+   .image_len = image_len,
+   .image_crc = image_crc,
+   .seal      = 0
+  };
+  record.seal = slot_seal(&record);
+  return slot_program_log(
+   slot_log_addr()+index*sizeof(slot_record_t), &record, sizeof(record)
+  );
+}
+
+// Slot functions
+
+int slots_enabled(void) {
+  return (FLASH_OPTR & FLASH_OPTR_DUALBANK)!=0;
+}
+
+slot_t slot_mapped(void) {
+  return (SYSCFG_MEMRMP & SYSCFG_MEMRMP_FB_MODE) ? SLOT_B : SLOT_A;
+}
+
+slot_t slot_other(const slot_t slot) {
+  return (slot==SLOT_A) ? SLOT_B : SLOT_A;
+}
+
+uint32_t slot_addr(const slot_t slot) {
+  return (slot==slot_mapped()) ? SLOT_LOWER_ADDR : SLOT_UPPER_ADDR;
+}
+
+uint32_t slot_first_page(const slot_t slot) {
+  return (slot==SLOT_B) ? SLOT_PAGES_PER_BANK+SLOT_FIRST_PAGE : SLOT_FIRST_PAGE;
+}
+
+void slot_erase_page(const uint32_t page) {
+  // Set BKER explicitly rather than relying on page overflowing into it
+  flash_wait_for_last_operation();
+  FLASH_CR &= ~((FLASH_CR_PNB_MASK<<FLASH_CR_PNB_SHIFT) | FLASH_CR_BKER);
+  if(page>=SLOT_PAGES_PER_BANK) {
+    FLASH_CR |= FLASH_CR_BKER;
+  }
+  FLASH_CR |=
+   ((page%SLOT_PAGES_PER_BANK)&FLASH_CR_PNB_MASK)<<FLASH_CR_PNB_SHIFT;
+  FLASH_CR |= FLASH_CR_PER;
+  FLASH_CR |= FLASH_CR_STRT;
+  flash_wait_for_last_operation();
+  FLASH_CR &= ~FLASH_CR_PER;
+  flash_clear_status_flags();
+}
+
+int slot_program_log(
+ const uint32_t addr, const void* record, const size_t len
+) {
+  const uint32_t* src = (const uint32_t*)record;
+  int success = 1;
+  flash_wait_for_last_operation();
+  flash_clear_status_flags();           // A stale error would block PG
+  for(size_t i=0; i<len/4 && success; i+=2) {
+    FLASH_CR |= FLASH_CR_PG;
+    MMIO32(addr+4*i)   = src[i];
+    MMIO32(addr+4*i+4) = src[i+1];
+    flash_wait_for_last_operation();
+    FLASH_CR &= ~FLASH_CR_PG;
+    success = (FLASH_SR & FLASH_SR_PROGRAM_ERRORS)==0;
+    flash_clear_status_flags();
+  }
+  return success;
+}
+
+slot_state_t slot_read_state(void) {
+  slot_state_t state = {
+   .active      = SLOT_A,
+   .trial       = SLOT_NONE,
+   .trial_boots = 0,
+   .trial_len   = 0,
+   .trial_crc   = 0,
+   .active_len  = 0,
+   .active_crc  = 0,
+   .records     = 0
+  };
+  int dual_bank = slots_enabled();
+  slot_record_t record;
+  uint32_t capacity = SLOT_LOG_SIZE/sizeof(slot_record_t);
+  for(uint32_t i=0; i<capacity; i++) {
+    const uint32_t* raw =
+     (const uint32_t*)(slot_log_addr()+i*sizeof(slot_record_t));
+    if(raw[0]==0xffffffff && raw[1]==0xffffffff) {
+      break;                                  // End of log
+    }
+    state.records = i+1;                      // Torn records still use space
+    if(!slot_read_record(i, &record) || (!dual_bank && record.slot!=SLOT_A)) {
+      continue;                               // Slot B is gone with one bank
+    }
+    slot_t slot = (slot_t)record.slot;
+    if(record.type==SLOT_RECORD_SELECT) {
+      state.trial = slot;
+      state.trial_boots = 0;
+      state.trial_len = record.image_len;
+      state.trial_crc = record.image_crc;
+    } else if(record.type==SLOT_RECORD_BOOT && slot==state.trial) {
+      state.trial_boots += 1;
+    } else if(record.type==SLOT_RECORD_CONFIRM) {
+      state.active = slot;
+      state.active_len = record.image_len;    // 0 in records before digests
+      state.active_crc = record.image_crc;
+      if(slot==state.trial) {
+        state.trial = SLOT_NONE;
+      }
+    }
+  }
+  return state;
+}
+
+slot_t slot_boot_target(const slot_state_t* state) {
+  if(state->trial!=SLOT_NONE && state->trial_boots<SLOT_TRIAL_BOOTS_MAX) {
+    return state->trial;
+  } else {
+    return state->active;
+  }
+}
+
+int slot_append(
+ const uint8_t type, const slot_t slot,
+ const uint32_t image_len, const uint32_t image_crc
+) {
+  if(slot!=SLOT_A && (slot!=SLOT_B || !slots_enabled())) {
+    return 0;
+  }
+  slot_state_t state = slot_read_state();
+  uint32_t index = state.records;
+  int success = 1;
+  flash_unlock();
+  if(index>=SLOT_LOG_SIZE/sizeof(slot_record_t)) {
+    // Log full: erase it and write back the replayed state
+    slot_erase_page(SLOT_LOG_PAGE);
+    index = 0;
+    success = slot_program_record(
+     index++, SLOT_RECORD_CONFIRM, state.active,
+     state.active_len, state.active_crc
+    );
+    if(state.trial!=SLOT_NONE) {
+      success = success && slot_program_record(
+       index++, SLOT_RECORD_SELECT, state.trial,
+       state.trial_len, state.trial_crc
+      );
+      for(uint32_t i=0; i<state.trial_boots; i++) {
+        success = success &&
+         slot_program_record(index++, SLOT_RECORD_BOOT, state.trial, 0, 0);
+      }
+    }
+  }
+  success = success &&
+   slot_program_record(index, type, slot, image_len, image_crc);
+  flash_lock();
+  return success;
+}
+
+int slot_boot_digest(
+ const slot_state_t* state, uint32_t* image_len_o, uint32_t* image_crc_o
+) {
+  if(slot_boot_target(state)==state->trial) {
+    *image_len_o = state->trial_len;
+    *image_crc_o = state->trial_crc;
+  } else {
+    *image_len_o = state->active_len;
+    *image_crc_o = state->active_crc;
+  }
+  return *image_len_o!=0;
+}
+
+int slot_verify_boot_target(const uint32_t max_len) {
+  slot_state_t state = slot_read_state();
+  uint32_t image_len = 0;
+  uint32_t image_crc = 0;
+  return
+   slot_boot_digest(&state, &image_len, &image_crc) && image_len<=max_len &&
+   crc32(
+    0, (const uint8_t*)slot_addr(slot_boot_target(&state)), image_len
+   )==image_crc;
+}
+
+int slot_confirm_running(void) {
+  if(slots_enabled()) {
+    slot_state_t state = slot_read_state();
+    if(state.trial==slot_mapped()) {
+      return slot_append(
+       SLOT_RECORD_CONFIRM, state.trial, state.trial_len, state.trial_crc
+      );
+    }
+  }
+  return 1;
+}
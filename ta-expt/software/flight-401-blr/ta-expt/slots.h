@@ -0,0 +1,203 @@
+// slots.h
+// Tartan Artibeus EXPT board A/B application slot header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef SLOTS_H
+#define SLOTS_H
+
+// Standard library
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint32_t
+
+// Macros
+
+//// Slot layout; slot A starts at page 16 of bank 1 and slot B at page 16 of
+//// bank 2. Whichever slot is running is mapped at APP_ADDR (bank 2 is mapped
+//// at 0x08000000 by SYSCFG_MEMRMP FB_MODE), so both slots are linked for
+//// APP_ADDR and the other slot always appears 512 KB higher
+#define SLOT_FLASH_BASE     ((uint32_t)0x08000000U)
+#define SLOT_BANK_SIZE      ((uint32_t)0x00080000U)
+#define SLOT_PAGES_PER_BANK ((uint32_t)256)
+#define SLOT_FIRST_PAGE     ((uint32_t)16)          // Page within its bank
+#define SLOT_LOWER_ADDR     ((uint32_t)0x08008000U) // Slot in mapped bank
+#define SLOT_UPPER_ADDR     ((uint32_t)0x08088000U) // Slot in other bank
+
+//// Slot log; page 32 of bank 1, just past the largest slot A image. Records
+//// are appended in order and the page is compacted when full
+#define SLOT_LOG_PAGE       ((uint32_t)32)
+#define SLOT_LOG_OFFSET     ((uint32_t)0x00010000U) // From start of bank 1
+#define SLOT_LOG_SIZE       ((uint32_t)2048)
+
+//// FLASH_SR flags that mean a program operation did not complete
+#define FLASH_SR_PROGRAM_ERRORS \
+ (FLASH_SR_PROGERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_SIZERR | \
+  FLASH_SR_PGSERR | FLASH_SR_MISERR | FLASH_SR_FASTERR)
+
+//// Slot log record types
+#define SLOT_RECORD_MAGIC   ((uint8_t)0xa5)
+#define SLOT_RECORD_SELECT  ((uint8_t)0x01) // Boot this slot on trial
+#define SLOT_RECORD_BOOT    ((uint8_t)0x02) // Bootloader started the trial
+#define SLOT_RECORD_CONFIRM ((uint8_t)0x03) // Slot ran; make it the default
+
+//// Trial boots allowed before falling back to the confirmed slot
+#define SLOT_TRIAL_BOOTS_MAX ((uint32_t)1)
+
+//// Trial watchdog; the bootloader starts the IWDG before booting a trial
+//// image, so a trial image that hangs is reset and falls back. The image
+//// confirms its slot once its main loop has run for SLOT_CONFIRM_MS
+#define SLOT_TRIAL_WDG_MS    ((uint32_t)8000)  // Loop wakes at least at 1 Hz
+#define SLOT_CONFIRM_MS      ((uint32_t)60000)
+
+// Typedefs
+
+//// Slot IDs
+typedef enum slot {
+  SLOT_A    = ((uint8_t)0x00),
+  SLOT_B    = ((uint8_t)0x01),
+  SLOT_NONE = ((uint8_t)0xff)
+} slot_t;
+
+//// Slot log record; two double words, written by slot_program_log
+typedef struct slot_record {
+  uint8_t  magic;     // SLOT_RECORD_MAGIC
+  uint8_t  type;      // SLOT_RECORD_*
+  uint8_t  slot;      // SLOT_A or SLOT_B
+  uint8_t  reserved;  // 0xff
+  uint32_t image_len; // SLOT_RECORD_SELECT and CONFIRM only; else 0
+  uint32_t image_crc; // SLOT_RECORD_SELECT and CONFIRM only; else 0
+  uint32_t seal;      // crc32 of the preceding 12 bytes
+} slot_record_t;
+
+//// Slot state replayed from the log
+typedef struct slot_state {
+  slot_t   active;      // Last confirmed slot; SLOT_A if none
+  slot_t   trial;       // Selected but unconfirmed slot; SLOT_NONE if none
+  uint32_t trial_boots; // Trial boots started since the last select
+  uint32_t trial_len;   // Image length given when the trial was selected
+  uint32_t trial_crc;   // Image CRC-32 given when the trial was selected
+  uint32_t active_len;  // Image length of the active slot; 0 if unknown
+  uint32_t active_crc;  // Image CRC-32 of the active slot
+  uint32_t records;     // Valid records in the log page
+} slot_state_t;
+
+// Slot functions
+
+/*  int slots_enabled(void)
+ *  Return:
+ *    Non-zero if the flash is in dual-bank mode, so slot B exists
+ */
+int slots_enabled(void);
+
+/*  slot_t slot_mapped(void)
+ *  Return:
+ *    The slot currently mapped at APP_ADDR
+ */
+slot_t slot_mapped(void);
+
+/*  slot_t slot_other(const slot_t slot)
+ *  Return:
+ *    SLOT_B for SLOT_A and vice versa
+ */
+slot_t slot_other(const slot_t slot);
+
+/*  uint32_t slot_addr(const slot_t slot)
+ *  Return:
+ *    Start address of slot in the current memory map
+ */
+uint32_t slot_addr(const slot_t slot);
+
+/*  uint32_t slot_first_page(const slot_t slot)
+ *  Return:
+ *    Physical page number of the first page of slot; bank 2 pages are 256
+ *    and up, independent of the memory map
+ */
+uint32_t slot_first_page(const slot_t slot);
+
+/*  void slot_erase_page(const uint32_t page)
+ *    page: physical page number, 0 to 511; flash must be unlocked
+ */
+void slot_erase_page(const uint32_t page);
+
+/*  int slot_program_log(
+ *   const uint32_t addr, const void* record, const size_t len
+ *  )
+ *    addr:   erased, double-word aligned log address; flash must be unlocked
+ *    record: len bytes, a multiple of 8, ending in a crc32 seal over the rest.
+ *            The slot, queue and job logs all write records this way, so a
+ *            record torn by a reset or a failed write fails its seal and is
+ *            skipped when the log is replayed
+ *  Return:
+ *    0 to indicate FLASH_SR reported a program error
+ *    Non-zero to indicate success
+ */
+int slot_program_log(
+ const uint32_t addr, const void* record, const size_t len
+);
+
+/*  slot_state_t slot_read_state(void)
+ *  Return:
+ *    State replayed from the slot log; without dual-bank flash only slot A
+ *    records count
+ */
+slot_state_t slot_read_state(void);
+
+/*  slot_t slot_boot_target(const slot_state_t* state)
+ *  Return:
+ *    The trial slot if it has boots left, else the active slot
+ */
+slot_t slot_boot_target(const slot_state_t* state);
+
+/*  int slot_append(
+ *   const uint8_t type, const slot_t slot,
+ *   const uint32_t image_len, const uint32_t image_crc
+ *  )
+ *    Appends a record to the slot log, compacting the log if it is full.
+ *    Without dual-bank flash only slot A records are taken; the slot A
+ *    CONFIRM written by BOOTLOADER_JUMP then carries its image digest
+ *  Return:
+ *    0 to indicate failure
+ *    Non-zero to indicate success
+ */
+int slot_append(
+ const uint8_t type, const slot_t slot,
+ const uint32_t image_len, const uint32_t image_crc
+);
+
+/*  int slot_boot_digest(
+ *   const slot_state_t* state, uint32_t* image_len_o, uint32_t* image_crc_o
+ *  )
+ *    image_len_o: Upon return, contains the length of the slot_boot_target
+ *                 image given when it was selected
+ *    image_crc_o: Upon return, contains its CRC-32
+ *  Return:
+ *    0 to indicate the image digest is unknown, e.g. it was not selected
+ *    through BOOTLOADER_SELECT or BOOTLOADER_JUMP with a CRC-32
+ *    Non-zero to indicate image_len_o and image_crc_o are valid
+ */
+int slot_boot_digest(
+ const slot_state_t* state, uint32_t* image_len_o, uint32_t* image_crc_o
+);
+
+/*  int slot_verify_boot_target(const uint32_t max_len)
+ *    max_len: longest image the slot can hold, in bytes
+ *  Return:
+ *    Non-zero if the image in the slot chosen by slot_boot_target matches the
+ *    length and CRC-32 recorded when it was selected; see slot_boot_digest
+ */
+int slot_verify_boot_target(const uint32_t max_len);
+
+/*  int slot_confirm_running(void)
+ *    Called by the application once it has proven healthy; confirms the
+ *    running slot if it is on trial, making it (and its image digest) the
+ *    slot the bootloader starts by default
+ *  Return:
+ *    0 to indicate the SLOT_RECORD_CONFIRM could not be written
+ *    Non-zero to indicate success, or that there was nothing to confirm
+ */
+int slot_confirm_running(void);
+
+#endif
@@ -0,0 +1,68 @@
+// timebase.h
+// Tartan Artibeus EXPT board monotonic timebase header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+// Standard library
+#include <stdint.h> // uint32_t, uint64_t
+
+// Initialization functions
+
+/*  void init_timebase(void)
+ *    Starts TIM2 counting at the core clock frequency, which init_clock or
+ *    init_handoff must have set; tim2_isr extends the 32-bit count to 64 bits
+ *    on each overflow, about every 54 s at 80 MHz. Unlike DWT_CYCCNT, TIM2
+ *    keeps counting while the core sleeps
+ */
+void init_timebase(void);
+
+// Timebase functions
+
+/*  uint64_t now_cycles(void)
+ *    Callable from ISRs and with interrupts masked
+ *  Return:
+ *    Core clock cycles since init_timebase
+ */
+uint64_t now_cycles(void);
+
+/*  uint64_t now_us(void)
+ *  Return:
+ *    Microseconds since init_timebase
+ */
+uint64_t now_us(void);
+
+/*  uint64_t cycles_from_ms(const uint32_t ms)
+ *  Return:
+ *    Core clock cycles in ms milliseconds, e.g. for timeouts against
+ *    now_cycles
+ */
+uint64_t cycles_from_ms(const uint32_t ms);
+
+/*  void delay_cycles(const uint64_t cycles)
+ *    Busy-waits until now_cycles has advanced by cycles
+ */
+void delay_cycles(const uint64_t cycles);
+
+/*  void delay_us(const uint32_t us)
+ *    Busy-waits for us microseconds
+ */
+void delay_us(const uint32_t us);
+
+/*  void delay_ms(const uint32_t ms)
+ *    Busy-waits for ms milliseconds
+ */
+void delay_ms(const uint32_t ms);
+
+/*  void timebase_stop(void)
+ *    Returns TIM2 and its interrupt to reset state before the jump to the
+ *    application, which starts its own timebase
+ */
+void timebase_stop(void);
+
+#endif
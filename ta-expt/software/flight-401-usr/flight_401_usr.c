@@ -12,7 +12,14 @@
 
 // ta-expt library
 #include <application.h>     // microcontroller utility functions
+#include <boot_record.h>     // boot milestone functions
+#include <cmd_queue.h>       // time-tagged command queue functions
+#include <crc32.h>           // CRC-32 functions
+#include <handoff.h>         // HANDOFF_FLAG_*
+#include <jobs.h>            // periodic job table functions
 #include <taolst_protocol.h> // protocol utility functions
+#include <timebase.h>        // monotonic timebase functions
+#include <trace.h>           // trace stream functions
 
 // Variables
 
@@ -22,22 +29,51 @@ int in_bootloader = 0;
 //// app_jump_pending is an extern variable used in write_reply
 int app_jump_pending = 0;
 
+//// uart_baud_pending is an extern variable modified in write_reply
+uint32_t uart_baud_pending = 0;
+
 // Main
 int main(void) {
   // Application initialization
-  init_clock();
-  init_uart();
-  init_rtc();
+  boot_record_mark(BOOT_MARK_APP_START);
+  uint32_t handoff = init_handoff();       // Reuse what the bootloader set up
+  if(!(handoff&HANDOFF_FLAG_CLOCK)) {
+    init_clock();
+  }
+  init_timebase();                         // Needs the clock
+  boot_record_mark(BOOT_MARK_APP_CLOCK);
+  if(!(handoff&HANDOFF_FLAG_UART)) {
+    init_uart();
+  }
+  boot_record_mark(BOOT_MARK_APP_UART);
+  if(!(handoff&HANDOFF_FLAG_RTC)) {
+    init_rtc();
+  }
+  boot_record_mark(BOOT_MARK_APP_RTC);
+  init_trace();
+  init_crc32();
+  cmd_queue_load();                        // Needs crc32
+  jobs_load();                             // Needs crc32
+  boot_record_mark(BOOT_MARK_APP_INIT);
   rx_cmd_buff_t rx_cmd_buff = {.size=CMD_MAX_LEN};
   clear_rx_cmd_buff(&rx_cmd_buff);
   tx_cmd_buff_t tx_cmd_buff = {.size=CMD_MAX_LEN};
   clear_tx_cmd_buff(&tx_cmd_buff);
+  boot_record_mark(BOOT_MARK_APP_READY);
+  TRACE1(TRACE_EVENT_BOOT, in_bootloader);
 
   // Application loop
   while(1) {
-    rx_usart1(&rx_cmd_buff);           // Collect command bytes
-    reply(&rx_cmd_buff, &tx_cmd_buff); // Command reply logic
-    tx_usart1(&tx_cmd_buff);           // Send a response if any
+    rx_usart1(&rx_cmd_buff);                 // Collect command bytes
+    baud_usart1(&rx_cmd_buff, &tx_cmd_buff); // Baud change and fallback
+    run_cmd_queue(&rx_cmd_buff, &tx_cmd_buff); // Inject due queued cmds
+    reply(&rx_cmd_buff, &tx_cmd_buff);       // Command reply logic
+    confirm_slot();                          // Refresh IWDG; keep slot later
+    slew_rtc();                              // Apply APP_ADJ_TIME slew
+    run_jobs();                              // Periodic on-board jobs
+    calibrate_lsi();                         // LSI drift measurement
+    tx_usart1(&tx_cmd_buff);                 // Send a response if any
+    sleep_usart1(&rx_cmd_buff,&tx_cmd_buff); // Sleep until next interrupt
   }
 
   // Should never reach this point
@@ -12,23 +12,316 @@
 #include <stdlib.h>               // atoi, atof
 
 // libopencm3 library
+#include <libopencm3/cm3/cortex.h>  // used in sleep_usart1
+#include <libopencm3/cm3/nvic.h>    // used in init_uart, sync_rtc_sec
 #include <libopencm3/cm3/scb.h>     // SCB_VTOR
+#include <libopencm3/stm32/exti.h>  // used in sync_rtc_sec, set_rtc_alarm
 #include <libopencm3/stm32/flash.h> // used in init_clock
 #include <libopencm3/stm32/gpio.h>  // used in init_gpio
-#include <libopencm3/stm32/pwr.h>   // used in set_rtc
+#include <libopencm3/stm32/iwdg.h>  // used in confirm_slot
+#include <libopencm3/stm32/pwr.h>   // used in set_rtc, rtc_wkup_isr
 #include <libopencm3/stm32/rcc.h>   // used in init_clock, init_rtc
 #include <libopencm3/stm32/rtc.h>   // used in rtc functions
+#include <libopencm3/stm32/timer.h> // used in calibrate_lsi
 #include <libopencm3/stm32/usart.h> // used in init_uart
 
 // ta-expt library
 #include <application.h>            // Header file
+#include <cmd_queue.h>              // used in run_cmd_queue
+#include <handoff.h>                // used in init_handoff
+#include <jobs.h>                   // used in run_jobs, sleep_usart1
+#include <slots.h>                  // used in confirm_slot
 #include <taolst_protocol.h>        // TAOLST protocol macros, typedefs, fnctns
+#include <timebase.h>               // used in baud_usart1, usart1_isr
+#include <trace.h>                  // TRACE0, TRACE1, TRACE2
 
 // Variables
 int rtc_set = 0; // Boolean; Zero until RTC date and time have been set
 
+//// Cached RTC time; rtc_wkup_isr advances it once per calendar second, so
+//// the calendar registers are only decoded by sync_rtc_sec
+volatile uint32_t rtc_sec = 0; // Seconds since 2000-01-01 11:58:56
+uint32_t rtc_prediv_s = RTC_PREDIV_S; // Synchronous prescaler in use
+uint32_t rtc_alarm_sec = RTC_ALARM_NONE; // Time Alarm A is set for
+int32_t rtc_slew_ticks = 0;          // Subsecond ticks left to slew by
+uint32_t rtc_slew_sec = 0;           // rtc_sec at the last slew step
+
+//// LSI calibration state; tim1_up_tim16_isr sums the capture intervals
+volatile uint32_t lsi_cal_count = 0;  // Captures so far
+volatile uint32_t lsi_cal_cycles = 0; // Timer cycles between them
+volatile int lsi_cal_done = 0;        // Boolean; set after the last capture
+uint32_t lsi_cal_last = 0;            // Previous capture
+int lsi_cal_running = 0;              // Boolean; TIM16 is measuring
+int lsi_cal_due = 1;                  // Boolean; measure at the next chance
+uint32_t lsi_prediv_s = RTC_PREDIV_S; // Best RTC_PREDIV_S for measured LSI
+int32_t lsi_ppm = 0;                  // Measured LSI error vs. 32 kHz
+
+//// Ephemeris kept current by JOB_EPHEMERIS from the TLE uplinked last
+eci_posn_t ephemeris = {.x=0.0f, .y=0.0f, .z=0.0f}; // km
+uint32_t ephemeris_sec = 0;         // rtc_sec of ephemeris; 0 if none
+
+//// USART1 baud rate state; see baud_usart1
+uint32_t uart_baud = UART_BAUD_DEFAULT; // Current USART1 baud rate
+int uart_baud_unconfirmed = 0;          // Boolean; Non-zero until valid cmd
+uint64_t uart_baud_changed = 0;         // Cycle count at last baud change
+extern uint32_t uart_baud_pending;      // Set by write_reply; 0 if none
+
+//// USART1 RX ring buffer; usart1_isr writes head, rx_usart1 writes tail
+volatile uint8_t rx_ring[RX_RING_SIZE];
+volatile size_t rx_ring_head = 0; // Index of next byte to be written
+volatile size_t rx_ring_tail = 0; // Index of next byte to be read
+volatile uint32_t rx_ring_cycles[RX_RING_SIZE]; // Cycle count at each byte
+uint32_t rx_cmd_cycles = 0;       // Cycle count at last byte of command
+
+//// Sleep-on-idle state
+extern int app_jump_pending; // Never sleep with a jump pending
+sleep_stats_t sleep_stats = {
+ .sleep_count       = 0,
+ .wake_latency_last = 0,
+ .wake_latency_max  = 0
+};
+int sleep_woke = 0;         // Boolean; Non-zero until first byte after wake
+uint64_t sleep_wake_cycles; // Cycle count at the end of the last WFI
+
+//// A/B slot state; see confirm_slot
+int slot_confirmed = 0;     // Boolean; Non-zero once confirm_slot has run
+
+//// Baud rates accepted by COMMON_SET_BAUD; USART1 runs from the 80 MHz APB2
+//// clock with 16x oversampling, so 5 Mbaud is the hardware limit
+static const uint32_t UART_BAUD_SUPPORTED[] = {
+ 115200, 230400, 460800, 921600, 1000000, 2000000, 4000000
+};
+
+// Helper functions
+
+//// Clears an RTC_ISR flag, leaving backup domain write access as it was so
+//// it can be called from ISRs. The other flags are written as 1, which leaves
+//// them alone, so the wakeup and alarm flags cannot clear one another
+static void rtc_clear_isr_flag(const uint32_t flag) {
+  int dbp = (PWR_CR1&PWR_CR1_DBP)!=0;
+  if(!dbp) {
+    pwr_disable_backup_domain_write_protect();
+  }
+  RTC_ISR = (~(flag|RTC_ISR_INIT))|(RTC_ISR&RTC_ISR_INIT);
+  if(!dbp) {
+    pwr_enable_backup_domain_write_protect();
+  }
+}
+
+//// Converts a value below 100 into the BCD form of the RTC registers
+static uint32_t rtc_bcd(const uint8_t value) {
+  return (uint32_t)(((value/10)<<4)|(value%10));
+}
+
+//// Converts an RTC_SSR value of at most rtc_prediv_s into nanoseconds into
+//// the second
+static uint32_t rtc_ss_to_ns(const uint32_t ss) {
+  uint32_t ticks = (ss<=rtc_prediv_s) ? (rtc_prediv_s-ss) : 0;
+  return ticks*(1000000000/(rtc_prediv_s+1));
+}
+
+//// Converts seconds since 2000-01-01 11:58:56 into calendar form
+static date_time_t rtc_date_time(const uint32_t sec) {
+  //   J2000 Julian date: 2451545
+  // modify sec to indicate seconds since 2000-01-01 00:00:00
+  //   (Julian date ~2451544.5)
+  //   this modification makes the later math simpler
+  uint32_t sec_since_y2k = sec+43136;
+  // calculate whole days since Julian date ~2451544.5
+  int32_t day_since_y2k = (int32_t)(sec_since_y2k/86400);
+  // track the leftover seconds
+  uint32_t remaining_sec = sec_since_y2k%86400;
+  // calculate the Julian date omitting any remaining_sec
+  //   if day_since_y2k==0, jd should be 2451545 b/c remaining_sec<86400
+  int32_t jd = 2451545+day_since_y2k;
+  // convert jd into year, month, and day (see fliegel1968letters)
+  int32_t l = jd+68569;
+  int32_t n = 4*l/146097;
+  l = l-(146097*n+3)/4;
+  int32_t i = 4000*(l+1)/1461001;
+  l = l-1461*i/4+31;
+  int32_t j = 80*l/2447;
+  int32_t k = l-2447*j/80;
+  l = j/11;
+  j = j+2-12*l;
+  i = 100*(n-49)+i+l;
+  // convert remaining_sec into hour, minute, second
+  date_time_t date_time = {
+   .year       = (int16_t)(i),
+   .month      = (uint8_t)(j),
+   .day        = (uint8_t)(k),
+   .hour       = (uint8_t)(remaining_sec/3600),
+   .minute     = (uint8_t)((remaining_sec%3600)/60),
+   .second     = (uint8_t)((remaining_sec%3600)%60),
+   .nanosecond = 0
+  };
+  return date_time;
+}
+
+//// Reads rtc_sec with the subsecond count of the same second; a tick that
+//// rtc_wkup_isr has not serviced yet is still pending in RTC_ISR_WUTF. A
+//// shift with RTC_SHIFTR_ADD1S can leave RTC_SSR above rtc_prediv_s, which
+//// puts the time in the second before the calendar one
+static uint32_t read_rtc_sec(uint32_t* ns_o) {
+  uint32_t base;
+  uint32_t sec;
+  uint32_t ss;
+  do {
+    base = rtc_sec;
+    ss = RTC_SSR;
+    sec = base+((RTC_ISR&RTC_ISR_WUTF) ? 1 : 0);
+  } while(ss!=RTC_SSR || base!=rtc_sec);
+  if(ss>rtc_prediv_s) {
+    sec -= 1;
+    ss -= rtc_prediv_s+1;
+  }
+  *ns_o = rtc_ss_to_ns(ss);
+  return sec;
+}
+
+//// Starts the 1 Hz RTC wakeup tick, which counts ck_spre edges and so stays
+//// in step with the calendar seconds, then loads rtc_sec from the calendar
+static void sync_rtc_sec(void) {
+  nvic_disable_irq(NVIC_RTC_WKUP_IRQ);
+  pwr_disable_backup_domain_write_protect();
+  rtc_unlock();
+  rtc_set_wakeup_time(0,RTC_CR_WUCLKSEL_SPRE);      // Reload 0: every second
+  RTC_CR |= RTC_CR_WUTIE;
+  rtc_lock();
+  exti_set_trigger(EXTI20,EXTI_TRIGGER_RISING);     // EXTI20 is RTC wakeup
+  exti_enable_request(EXTI20);
+  uint32_t tr;
+  uint32_t dr;
+  do {                                              // Retry the calendar read
+    rtc_clear_isr_flag(RTC_ISR_WUTF);               //  if a second boundary
+    exti_reset_request(EXTI20);                     //  falls within it; any
+    nvic_clear_pending_irq(NVIC_RTC_WKUP_IRQ);      //  later tick stays
+    tr = RTC_TR;                                    //  pending for
+    dr = RTC_DR;                                    //  rtc_wkup_isr
+  } while(RTC_ISR&RTC_ISR_WUTF);
+  pwr_enable_backup_domain_write_protect();
+  int32_t year = (int32_t)(((dr>>20)*10)+((dr>>16)&0xf)+2000);
+  int32_t month = (int32_t)((((dr>>12)&0x1)*10)+((dr>>8)&0xf));
+  int32_t day = (int32_t)((((dr>>4)&0x3)*10)+(dr&0xf));
+  int32_t hour = (int32_t)((((tr>>20)&0x3)*10)+((tr>>16)&0xf));
+  int32_t minute = (int32_t)((((tr>>12)&0x7)*10)+((tr>>8)&0xf));
+  int32_t second = (int32_t)((((tr>>4)&0x7)*10)+(tr&0xf));
+  // Calculate JD from year, month, day
+  int32_t jd =
+   day-32075+1461*(year+4800+(month-14)/12)/4
+   +367*(month-2-(month-14)/12*12)/12-3
+   *((year+4900+(month-14)/12)/100)/4;
+  // Convert into seconds since 2000-01-01 11:58:56
+  rtc_sec = (uint32_t)(86400*(jd-2451545)+60*(60*hour+minute)+second-43136);
+  rtc_prediv_s = RTC_PRER&0x7fff;                   // May come from bootloader
+  nvic_enable_irq(NVIC_RTC_WKUP_IRQ);
+}
+
+//// Moves the RTC by ticks subsecond ticks (-rtc_prediv_s to rtc_prediv_s)
+//// without stopping it. A delay is added to RTC_SSR; an advance adds a
+//// second and the complementary delay, which moves the calendar without a
+//// wakeup tick, so rtc_sec is reloaded
+static void shift_rtc(const int32_t ticks) {
+  pwr_disable_backup_domain_write_protect();
+  rtc_unlock();
+  while(RTC_ISR & RTC_ISR_SHPF) {}
+  if(ticks>0) {
+    RTC_SHIFTR = RTC_SHIFTR_ADD1S|(rtc_prediv_s+1-(uint32_t)ticks);
+  } else {
+    RTC_SHIFTR = (uint32_t)(-ticks);
+  }
+  while(RTC_ISR & RTC_ISR_SHPF) {}
+  rtc_lock();
+  pwr_enable_backup_domain_write_protect();
+  if(ticks>0) {
+    sync_rtc_sec();
+  }
+}
+
+//// Propagates the TLE uplinked last to the current RTC time
+static void refresh_ephemeris(void) {
+  extern sgp4_state_t sgp4_state;   // Set by COMMON_ASCII "TLE"; block scope
+  extern date_time_t tle_epoch;     //  so get_tle_epoch does not shadow it
+  if(rtc_set && tle_epoch.year!=0) {
+    date_time_t at = get_date_time_rtc();
+    float tsince = calc_tdiff_minute(&at,&tle_epoch);
+    ephemeris = sgp4_propagate(&sgp4_state, tsince);
+    ephemeris_sec = rtc_sec;
+  }
+}
+
+//// Programs RTC smooth calibration for an RTC clock running ppm_fast parts
+//// per million fast; the correction saturates near +/-488 ppm
+static void rtc_smooth_calibrate(const int32_t ppm_fast) {
+  // RTC_CALR adds 512*CALP-CALM pulses every 2^20 RTCCLK cycles
+  int32_t pulses = (int32_t)(-((int64_t)ppm_fast*1048576)/1000000);
+  pulses = (pulses<-511) ? -511 : ((pulses>512) ? 512 : pulses);
+  uint32_t calr = (pulses>0) ?
+   (RTC_CALR_CALP|(uint32_t)(512-pulses)) : (uint32_t)(-pulses);
+  pwr_disable_backup_domain_write_protect();
+  rtc_unlock();
+  while(RTC_ISR&RTC_ISR_RECALPF) {}
+  RTC_CALR = calr;
+  rtc_lock();
+  pwr_enable_backup_domain_write_protect();
+}
+
+//// Starts timing LSI_CAL_CAPTURES periods of 8 LSI cycles with TIM16 input
+//// capture; tim1_up_tim16_isr sets lsi_cal_done when it has them all
+static void start_lsi_cal(void) {
+  rcc_periph_clock_enable(RCC_TIM16);
+  rcc_periph_reset_pulse(RST_TIM16);
+  MMIO32(TIM16+TIM16_OR1_OFFSET) = TIM16_OR1_TI1_RMP_LSI;
+  TIM_CCMR1(TIM16) = TIM_CCMR1_CC1S_IN_TI1|TIM_CCMR1_IC1PSC_8;
+  TIM_CCER(TIM16) = TIM_CCER_CC1E;                  // Rising edges
+  timer_set_period(TIM16,0xffff);                   // Free-running 16 bits
+  lsi_cal_count = 0;
+  lsi_cal_cycles = 0;
+  lsi_cal_done = 0;
+  timer_enable_irq(TIM16,TIM_DIER_CC1IE);
+  nvic_enable_irq(NVIC_TIM1_UP_TIM16_IRQ);
+  timer_enable_counter(TIM16);
+  lsi_cal_running = 1;
+  lsi_cal_due = 0;
+}
+
 // Initialization functions
 
+uint32_t init_handoff(void) {
+  handoff_t handoff;
+  if(!handoff_take(&handoff)) {
+    return 0;
+  }
+  uint32_t flags = handoff.flags;
+  if(flags&HANDOFF_FLAG_CLOCK) {
+    rcc_ahb_frequency = 80000000;           // As left by the bootloader
+    rcc_apb1_frequency = 40000000;
+    rcc_apb2_frequency = 80000000;
+  } else {
+    flags = 0;                              // USART1 and RTC need the clock
+  }
+  if((flags&HANDOFF_FLAG_UART) && uart_baud_supported(handoff.uart_baud)) {
+    uart_baud = handoff.uart_baud;
+    uart_baud_unconfirmed = 0;
+    rx_ring_head = 0;
+    rx_ring_tail = 0;
+    for(size_t i=0; i<handoff.rx_len && i<RX_RING_SIZE-1; i++) {
+      rx_ring[rx_ring_head] = handoff.rx[i];
+      rx_ring_head += 1;
+    }
+    usart_enable_rx_interrupt(USART1);
+    nvic_enable_irq(NVIC_USART1_IRQ);
+  } else {
+    flags &= ~HANDOFF_FLAG_UART;
+  }
+  if(flags&HANDOFF_FLAG_RTC) {
+    rcc_periph_clock_enable(RCC_PWR);       // As in init_rtc; used by set_rtc
+    rtc_set = (flags&HANDOFF_FLAG_RTC_SET)!=0;
+    sync_rtc_sec();                         // Counter is not handed over
+  }
+  return flags;
+}
+
 void init_clock(void) {
   rcc_osc_on(RCC_HSI16);                    // 16 MHz internal RC oscillator
   rcc_wait_for_osc_ready(RCC_HSI16);        // Wait until oscillator is ready
@@ -72,13 +365,19 @@ void init_uart(void) {
   gpio_mode_setup(GPIOA,GPIO_MODE_AF,GPIO_PUPD_NONE,GPIO9|GPIO10);
   gpio_set_af(GPIOA,GPIO_AF7,GPIO9);  // USART1_TX is alternate function 7
   gpio_set_af(GPIOA,GPIO_AF7,GPIO10); // USART1_RX is alternate function 7
-  usart_set_baudrate(USART1,115200);
+  usart_set_baudrate(USART1,UART_BAUD_DEFAULT);
   usart_set_databits(USART1,8);
   usart_set_stopbits(USART1,USART_STOPBITS_1);
   usart_set_mode(USART1,USART_MODE_TX_RX);
   usart_set_parity(USART1,USART_PARITY_NONE);
   usart_set_flow_control(USART1,USART_FLOWCONTROL_NONE);
   usart_enable(USART1);
+  uart_baud = UART_BAUD_DEFAULT;
+  uart_baud_unconfirmed = 0;
+  rx_ring_head = 0;
+  rx_ring_tail = 0;
+  usart_enable_rx_interrupt(USART1);  // RX bytes go to rx_ring via usart1_isr
+  nvic_enable_irq(NVIC_USART1_IRQ);   // RX interrupt also wakes sleep_usart1
 }
 
 void init_rtc(void) {
@@ -90,11 +389,34 @@ void init_rtc(void) {
   rcc_enable_rtc_clock();            // Enable RTC
   rtc_wait_for_synchro();
   pwr_enable_backup_domain_write_protect();
-  rtc_set = 0;                       // RTC date and time has not yet been set
+  // The RTC keeps running through a reset; it has been set if the backup
+  // domain holds a calendar (INITS) and the prescaler set_rtc programs,
+  // not the reset value
+  rtc_set =
+   (RTC_ISR&RTC_ISR_INITS)!=0 && ((RTC_PRER>>16)&0x7f)==RTC_PREDIV_A;
+  sync_rtc_sec();                    // Jobs need the 1 Hz tick even if unset
 }
 
 // Utility functions
 
+int uart_baud_supported(const uint32_t baud) {
+  size_t count = sizeof(UART_BAUD_SUPPORTED)/sizeof(UART_BAUD_SUPPORTED[0]);
+  for(size_t i=0; i<count; i++) {
+    if(UART_BAUD_SUPPORTED[i]==baud) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void set_uart_baud(const uint32_t baud) {
+  usart_disable(USART1);                         // BRR is written with UE==0
+  usart_set_baudrate(USART1,baud);
+  USART_ICR(USART1) = USART_ICR_ORECF|USART_ICR_FECF; // Drop stale errors
+  usart_enable(USART1);
+  uart_baud = baud;
+}
+
 int set_rtc(const uint32_t sec, const uint32_t ns) {
   // sec and ns represent time since J2000
   //   J2000 UTC: 2000-01-01 11:58:55.816
@@ -113,54 +435,38 @@ int set_rtc(const uint32_t sec, const uint32_t ns) {
     }
   }
   // sec_rounded represents seconds since 2000-01-01 11:58:56
-  //   J2000 Julian date: 2451545
-  // modify sec_rounded to indicate seconds since 2000-01-01 00:00:00
-  //   (Julian date ~2451544.5)
-  //   this modification makes the later math simpler
-  uint32_t sec_since_y2k = sec_rounded+43136;
-  // calculate whole days since Julian date ~2451544.5
-  int32_t day_since_y2k = (int32_t)(sec_since_y2k/86400);
-  // track the leftover seconds
-  uint32_t remaining_sec = sec_since_y2k%86400;
-  // calculate the Julian date omitting any remaining_sec
-  //   if day_since_y2k==0, jd should be 2451545 b/c remaining_sec<86400
-  int32_t jd = 2451545+day_since_y2k;
-  // convert jd into year, month, and day (see fliegel1968letters)
-  int32_t l = jd+68569;
-  int32_t n = 4*l/146097;
-  l = l-(146097*n+3)/4;
-  int32_t i = 4000*(l+1)/1461001;
-  l = l-1461*i/4+31;
-  int32_t j = 80*l/2447;
-  int32_t k = l-2447*j/80;
-  l = j/11;
-  j = j+2-12*l;
-  i = 100*(n-49)+i+l;
-  // convert into uint8_t forms expected by RTC
-  uint8_t year = (uint8_t)(i-2000);
-  uint8_t month = (uint8_t)(j);
-  uint8_t day = (uint8_t)(k);
-  // convert remaining_sec into hour, minute, second
-  uint8_t hour = (uint8_t)(remaining_sec/3600);
-  uint8_t minute = (uint8_t)((remaining_sec%3600)/60);
-  uint8_t second = (uint8_t)((remaining_sec%3600)%60);
+  date_time_t date_time = rtc_date_time(sec_rounded);
+  // a step replaces any slew still under way
+  rtc_slew_ticks = 0;
+  // use the synchronous prescaler that suits the LSI as last measured
+  lsi_cal_due = (rtc_prediv_s!=lsi_prediv_s); // Smooth calibration is stale
+  rtc_prediv_s = lsi_prediv_s;
+  // convert nanosecond into subsecond ticks
+  uint32_t ticks = nanosecond/(1000000000/(rtc_prediv_s+1));
   // set the RTC
   pwr_disable_backup_domain_write_protect();
   rtc_unlock();
   rtc_set_init_flag();
   rtc_wait_for_init_ready();
-  if(!rtc_set) {
-    rtc_set_prescaler((uint32_t)249,(uint32_t)127);
-    rtc_enable_bypass_shadow_register();
-  }
-  rtc_calendar_set_year(year);
-  rtc_calendar_set_month(month);
-  rtc_calendar_set_day(day);
+  rtc_set_prescaler(rtc_prediv_s,RTC_PREDIV_A);
+  rtc_enable_bypass_shadow_register();
+  rtc_calendar_set_year((uint8_t)(date_time.year-2000));
+  rtc_calendar_set_month(date_time.month);
+  rtc_calendar_set_day(date_time.day);
   rtc_set_am_format();
-  rtc_time_set_time(hour,minute,second,1);
+  rtc_time_set_time(date_time.hour,date_time.minute,date_time.second,1);
   rtc_clear_init_flag();
+  // the calendar restarts at the top of the second; advance it by ticks with
+  // a one-second add and a (rtc_prediv_s+1-ticks) delay. RTC_SSR reads above
+  // rtc_prediv_s until it has counted the delay down, and read_rtc_sec puts
+  // those readings in the second before
+  if(ticks>0) {
+    RTC_SHIFTR = RTC_SHIFTR_ADD1S|(rtc_prediv_s+1-ticks);
+    while(RTC_ISR & RTC_ISR_SHPF) {}
+  }
   rtc_lock();
   pwr_enable_backup_domain_write_protect();
+  sync_rtc_sec();
   // record and return success
   rtc_set = 1;
   return rtc_set;
@@ -168,43 +474,105 @@ int set_rtc(const uint32_t sec, const uint32_t ns) {
 
 int get_rtc(uint32_t* sec, uint32_t* ns) {
   if(rtc_set) {
-    // Read all values "atomically"
-    int32_t year = (int32_t)(((RTC_DR>>20)*10)+((RTC_DR>>16)&0xf)+2000);
-    int32_t month = (int32_t)((((RTC_DR>>12)&0x1)*10)+((RTC_DR>>8)&0xf));
-    int32_t day = (int32_t)((((RTC_DR>>4)&0x3)*10)+(RTC_DR&0xf));
-    int32_t hour = (int32_t)((((RTC_TR>>20)&0x3)*10)+((RTC_TR>>16)&0xf));
-    int32_t minute = (int32_t)((((RTC_TR>>12)&0x7)*10)+((RTC_TR>>8)&0xf));
-    int32_t second = (int32_t)((((RTC_TR>>4)&0x7)*10)+(RTC_TR&0xf));
-    // Calculate JD from year, month, day
-    int32_t jd =
-     day-32075+1461*(year+4800+(month-14)/12)/4
-     +367*(month-2-(month-14)/12*12)/12-3
-     *((year+4900+(month-14)/12)/100)/4;
-    // Convert into seconds since 2000-01-01 11:58:56
-    *sec = (uint32_t)(86400*(jd-2451545)+60*(60*hour+minute)+second-43136);
-    // Write nanoseconds
-    *ns = (uint32_t)(184000000);
+    uint32_t subsecond;
+    *sec = read_rtc_sec(&subsecond);
+    // Write nanoseconds, carrying into sec past the end of the second
+    *ns = (uint32_t)(184000000)+subsecond;
+    if(*ns>=1000000000) {
+      *sec += 1;
+      *ns -= 1000000000;
+    }
   }
   return rtc_set;
 }
 
+int get_rtc_rx_stamp(uint32_t* sec, uint32_t* ns) {
+  uint32_t now_sec = 0;
+  uint32_t now_ns = 0;
+  uint32_t cycles = (uint32_t)now_cycles()-rx_cmd_cycles;
+  if(!get_rtc(&now_sec,&now_ns)) {
+    return 0;
+  }
+  uint32_t ago_ns = (uint32_t)(                     // Since the last byte;
+   ((uint64_t)cycles)*1000/(rcc_ahb_frequency/1000000) //  well under 1 s
+  );
+  if(ago_ns>=NS_PER_SEC) {
+    return 0;
+  }
+  if(now_ns>=ago_ns) {
+    *ns = now_ns-ago_ns;
+    *sec = now_sec;
+  } else {
+    *ns = NS_PER_SEC-(ago_ns-now_ns);
+    *sec = now_sec-1;
+  }
+  return 1;
+}
+
+int adjust_rtc(const int32_t offset_ns) {
+  if(!rtc_set || offset_ns<=-((int32_t)NS_PER_SEC) ||
+   offset_ns>=((int32_t)NS_PER_SEC)) {
+    return 0;
+  }
+  int32_t tick_ns = (int32_t)(NS_PER_SEC/(rtc_prediv_s+1));
+  int32_t ticks = (offset_ns+((offset_ns<0) ? -tick_ns : tick_ns)/2)/tick_ns;
+  if(ticks>(int32_t)rtc_prediv_s) {                // Rounded up to a second
+    ticks = (int32_t)rtc_prediv_s;
+  } else if(ticks<-((int32_t)rtc_prediv_s)) {
+    ticks = -((int32_t)rtc_prediv_s);
+  }
+  int step = (offset_ns>RTC_SLEW_THRESHOLD_NS) ||
+   (offset_ns<-RTC_SLEW_THRESHOLD_NS);
+  TRACE2(TRACE_EVENT_TIME_ADJ, offset_ns, step);
+  if(step) {
+    rtc_slew_ticks = 0;
+    if(ticks!=0) {
+      shift_rtc(ticks);
+    }
+  } else {
+    rtc_slew_ticks = ticks;                          // Replaces any slew left
+    rtc_slew_sec = rtc_sec;
+  }
+  return 1;
+}
+
+void set_rtc_alarm(const uint32_t sec) {
+  date_time_t at = rtc_date_time(sec);
+  nvic_disable_irq(NVIC_RTC_ALARM_IRQ);
+  pwr_disable_backup_domain_write_protect();
+  rtc_unlock();
+  RTC_CR &= ~(RTC_CR_ALRAE|RTC_CR_ALRAIE);
+  while(!(RTC_ISR&RTC_ISR_ALRAWF)) {}
+  RTC_ALRMAR =                                      // Day of the month, hour,
+   (rtc_bcd(at.day)<<24)|(rtc_bcd(at.hour)<<16)|   //  minute and second all
+   (rtc_bcd(at.minute)<<8)|rtc_bcd(at.second);      //  have to match
+  RTC_ALRMASSR = 0;                                 // Subseconds not compared
+  rtc_clear_isr_flag(RTC_ISR_ALRAF);
+  RTC_CR |= RTC_CR_ALRAE|RTC_CR_ALRAIE;
+  rtc_lock();
+  pwr_enable_backup_domain_write_protect();
+  exti_set_trigger(EXTI18,EXTI_TRIGGER_RISING);     // EXTI18 is RTC alarm
+  exti_enable_request(EXTI18);
+  exti_reset_request(EXTI18);
+  nvic_clear_pending_irq(NVIC_RTC_ALARM_IRQ);
+  nvic_enable_irq(NVIC_RTC_ALARM_IRQ);
+  rtc_alarm_sec = sec;
+}
+
+void clear_rtc_alarm(void) {
+  pwr_disable_backup_domain_write_protect();
+  rtc_unlock();
+  RTC_CR &= ~(RTC_CR_ALRAE|RTC_CR_ALRAIE);
+  rtc_lock();
+  pwr_enable_backup_domain_write_protect();
+  rtc_alarm_sec = RTC_ALARM_NONE;
+}
+
 date_time_t get_date_time_rtc(void) {
-  date_time_t now = {
-   .year       = 0,
-   .month      = 0,
-   .day        = 0,
-   .hour       = 0,
-   .minute     = 0,
-   .second     = 0,
-   .nanosecond = 0
-  };
-  now.year = (int16_t)(((RTC_DR>>20)*10)+((RTC_DR>>16)&0xf)+2000);
-  now.month = (uint8_t)((((RTC_DR>>12)&0x1)*10)+((RTC_DR>>8)&0xf));
-  now.day = (uint8_t)((((RTC_DR>>4)&0x3)*10)+(RTC_DR&0xf));
-  now.hour = (uint8_t)((((RTC_TR>>20)&0x3)*10)+((RTC_TR>>16)&0xf));
-  now.minute = (uint8_t)((((RTC_TR>>12)&0x7)*10)+((RTC_TR>>8)&0xf));
-  now.second = (uint8_t)((((RTC_TR>>4)&0x7)*10)+(RTC_TR&0xf));
-  now.nanosecond = (uint32_t)(0); // zero until subsecond support
+  uint32_t ns = 0;
+  uint32_t sec = rtc_set ? read_rtc_sec(&ns) : 0;
+  date_time_t now = rtc_date_time(sec);
+  now.nanosecond = ns;
   return now;
 }
 
@@ -463,10 +831,13 @@ float calc_tdiff_minute(const date_time_t* event, const date_time_t* epoch) {
    );
 }
 
-eci_posn_t sgp4(
- const float bstar, const float i0, const float o0, const float e0,
- const float w0, const float m0, const float n0, const float tsince
-) {
+void sgp4_init(const tle_t* tle, sgp4_state_t* state_o) {
+  const float bstar = tle->bstar;
+  const float i0 = tle->inclination;
+  const float e0 = tle->eccentricity;
+  const float w0 = tle->arg_of_perigee;
+  const float m0 = tle->mean_anomaly;
+  const float n0 = tle->mean_motion;
   // Recover mean motion and semimajor axis     // line001-line013 boilerplate
   const float a1 =                                             // eq01,line014
    pow(STR3_KE/n0,STR3_TWO_THIRDS);
@@ -574,13 +945,72 @@ eci_posn_t sgp4(
    -1.0f*k2m3pinvsqn0pp*cosi0+                                 // thru line081
    k2r2m3pinvsqr2n0pp*(4.0f*cosi0-19.0f*cosi0*thetar2)*0.5f+
    k4m1p25pinvsqr2n0pp*cosi0*(3.0f-7.0f*thetar2)*2.0f;
-  const float mdf = m0+mdt*tsince;                             // eq22,line105
-  const float wdf = w0+wdt*tsince;                             // eq23,line106
-  const float odf = o0+odt*tsince;                             // eq24,line107
                                                                // omit line082
                                                                // omit line083
   const float uo = -3.5f*beta0r2*k2m3pinvsqn0pp*cosi0*c1;      // l79+ line084
                                                                // omit line085
+  const float ull =                                   // XLCOF //      line086
+   0.125f*a30dk2*sini0*(3.0f+5.0f*cosi0)/(1.0f+cosi0);         // omit line136
+  const float uaynl = 0.25f*a30dk2*sini0;             // AYCOF //      line087
+  const float c1r2 = c1*c1;                                    //      line092
+  const float c5 =                                             // eq18,line069
+   2.0f*q0msr4txir4dpsir3p5*a0pp*beta0r2*(
+    1.0f+2.75f*(etar2+e0eta)+e0eta*etar2
+   );
+  const float d2 = 4.0f*a0pp*xi*c1r2;                          // eq19,line093
+                                                               // omit line094
+  const float d3 = d2*xi*c1*(17.0f*a0pp+s)/3.0f;               // eq20,line095
+  const float d4 =                                             // eq21,line096
+   0.5f*d2*xi*xi*c1r2*a0pp*(221.0f*a0pp+31.0f*s)/3.0f;
+  // Save the epoch-only quantities sgp4_propagate needs
+  state_o->isimp = isimp;
+  state_o->bstar = bstar;
+  state_o->i0 = i0;
+  state_o->o0 = tle->raan;
+  state_o->e0 = e0;
+  state_o->w0 = w0;
+  state_o->m0 = m0;
+  state_o->n0pp = n0pp;
+  state_o->a0pp = a0pp;
+  state_o->cosi0 = cosi0;
+  state_o->sini0 = sini0;
+  state_o->thetar2 = thetar2;
+  state_o->thetar2t3m1 = thetar2t3m1;
+  state_o->nthetar2a1 = nthetar2a1;
+  state_o->mdt = mdt;
+  state_o->wdt = wdt;
+  state_o->odt = odt;
+  state_o->uo = uo;
+  state_o->c1 = c1;
+  state_o->c1r2 = c1r2;
+  state_o->c4 = c4;
+  state_o->c5 = c5;
+  state_o->d2 = d2;
+  state_o->d3 = d3;
+  state_o->d4 = d4;
+  state_o->eta = eta;
+  state_o->deltawc = bstar*c3*cos(w0);                         // OMGCOF
+  state_o->deltamc =                                           // XMCOF
+   -1.0f*STR3_TWO_THIRDS*q0msr4txir4*bstar*STR3_DU_PER_ER/e0eta;
+  state_o->deltam0 = pow(1.0f+eta*cos(m0),3.0f);               // DELMO
+  state_o->sinm0 = sin(m0);                                    // SINMO
+  state_o->ull = ull;
+  state_o->uaynl = uaynl;
+}
+
+eci_posn_t sgp4_propagate(const sgp4_state_t* state, const float tsince) {
+  const float e0 = state->e0;
+  const float n0pp = state->n0pp;
+  const float cosi0 = state->cosi0;
+  const float sini0 = state->sini0;
+  const float thetar2 = state->thetar2;
+  const float thetar2t3m1 = state->thetar2t3m1;
+  const float nthetar2a1 = state->nthetar2a1;
+  const float c1 = state->c1;
+  // Update for secular gravity and atmospheric drag
+  const float mdf = state->m0+state->mdt*tsince;               // eq22,line105
+  const float wdf = state->w0+state->wdt*tsince;               // eq23,line106
+  const float odf = state->o0+state->odt*tsince;               // eq24,line107
                                                                // omit line088
                                                                // omit line089
                                                                // omit line090
@@ -588,25 +1018,16 @@ eci_posn_t sgp4(
   float mptemp = mdf;                                          //      line109
   float wtemp = wdf;                                           //      line108
   float uatemp = 1.0f-c1*tsince;                      // TEMPA //      line112
-  float uetemp = bstar*c4*tsince;                     // TEMPE //      line113
+  float uetemp = state->bstar*state->c4*tsince;       // TEMPE //      line113
   float ultemp = 1.5f*c1*tsincer2;                    // TEMPL // l85+ line114
-  if(!isimp) {                                              // line091,line115
-    const float c1r2 = c1*c1;                                  //      line092
-    const float c5 =                                           // eq18,line069
-     2.0f*q0msr4txir4dpsir3p5*a0pp*beta0r2*(
-      1.0f+2.75f*(etar2+e0eta)+e0eta*etar2
-     );
-    const float d2 = 4.0f*a0pp*xi*c1r2;                        // eq19,line093
-                                                               // omit line094
-    const float d3 = d2*xi*c1*(17.0f*a0pp+s)/3.0f;             // eq20,line095
-    const float d4 =                                           // eq21,line096
-     0.5f*d2*xi*xi*c1r2*a0pp*(221.0f*a0pp+31.0f*s)/3.0f;
-    const float deltaw =                                       // eq25,line116
-     bstar*c3*cos(w0)*tsince;                                  // l82+
+  if(!state->isimp) {                                       // line091,line115
+    const float c1r2 = state->c1r2;                            //      line092
+    const float d2 = state->d2;                                // eq19,line093
+    const float d3 = state->d3;                                // eq20,line095
+    const float d4 = state->d4;                                // eq21,line096
+    const float deltaw = state->deltawc*tsince;                // eq25,line116
     const float deltam =                                       // eq26,line117
-     -1.0f*STR3_TWO_THIRDS*q0msr4txir4*bstar*STR3_DU_PER_ER/e0eta*
-     (pow(1.0f+eta*cos(mdf),3.0f)-                             // l83+
-      pow(1.0f+eta*cos(m0),3.0f));                             // l88+
+     state->deltamc*(pow(1.0f+state->eta*cos(mdf),3.0f)-state->deltam0);
                                                                // omit line118
     mptemp = mptemp+deltaw+deltam;                             //      line119
     wtemp = wtemp-deltaw-deltam;                               //      line120
@@ -615,7 +1036,7 @@ eci_posn_t sgp4(
     uatemp =                                                   //      line123
      uatemp-d2*tsincer2-d3*tsincer2*tsince-d4*tsince*tsincer2*tsince;
     uetemp =                                                   //      line124
-     uetemp+bstar*c5*(sin(mptemp)-sin(m0));
+     uetemp+state->bstar*state->c5*(sin(mptemp)-state->sinm0);
     ultemp =                                                   //      line125
      ultemp+                                                   // thru line126
      (d2+2.0f*c1r2)*tsincer2*tsince+                           // l97+
@@ -631,19 +1052,17 @@ eci_posn_t sgp4(
                                                                // omit line101
   const float mp = mptemp;                                     // eq27,line109
   const float w = wtemp;                                       // eq28,line108
-  const float o = odf+uo*tsincer2;                             // eq29,line111
-  const float a = a0pp*pow(uatemp,2.0f);                       // eq31,line127
+  const float o = odf+state->uo*tsincer2;                      // eq29,line111
+  const float a = state->a0pp*pow(uatemp,2.0f);                // eq31,line127
   const float e = e0-uetemp;                                   // eq30,line128
   const float l = mp+w+o+n0pp*ultemp;                          // eq32,line129
   const float beta = sqrt(1.0f-e*e);                           // eq33,line130
   const float n = STR3_KE/pow(a,1.5f);                         // eq34,line131
   // Long period periodics                         // line132-line134 comments
   const float axn = e*cos(w);                                  // eq35,line135
-  const float ull =                                   // XLCOF //      line086
-   0.125f*a30dk2*sini0*(3.0f+5.0f*cosi0)/(1.0f+cosi0);         // omit line136
-  const float ll = axn*ull/(a*beta*beta);                      // eq36,line137
-  const float uaynl = 0.25f*a30dk2*sini0;             // AYCOF //      line087
-  const float aynl = uaynl/(a*beta*beta);                      // eq37,line138
+                                                               // omit line136
+  const float ll = axn*state->ull/(a*beta*beta);               // eq36,line137
+  const float aynl = state->uaynl/(a*beta*beta);               // eq37,line138
   const float lt = l+ll;                                       // eq38,line139
   const float ayn = e*sin(w)+aynl;                             // eq39,line140
   // Solve Kepler's equation                       // line141-line143 comments
@@ -729,7 +1148,7 @@ eci_posn_t sgp4(
    deltar;
   const float uk = u+deltau;                                   // eq61,line183
   const float ok = o+deltao;                                   // eq62,line184
-  const float ik = i0+deltai;                                  // eq63,line185
+  const float ik = state->i0+deltai;                           // eq63,line185
   const float rkdt = rdt+deltardt;                             // eq64,line186
   const float rfkdt = rfdt+deltarfdt;                          // eq65,line187
   // Unit orientation vectors                      // line188-line190 comments
@@ -766,24 +1185,119 @@ eci_posn_t sgp4(
   return eci_posn;
 }
 
+// Interrupt service routines
+
+void usart1_isr(void) {
+  while(usart_get_flag(USART1,USART_ISR_RXNE)) {     // Drain RX data register
+    uint8_t b = usart_recv(USART1);                  // Receive byte from RX pin
+    size_t next = (rx_ring_head+1)&(RX_RING_SIZE-1); //
+    if(next!=rx_ring_tail) {                         // Drop byte if ring full
+      rx_ring[rx_ring_head] = b;                     //
+      rx_ring_cycles[rx_ring_head] =                 // Arrival time for
+       (uint32_t)now_cycles();                       //  get_rtc_rx_stamp
+      rx_ring_head = next;                           //
+    }                                                //
+  }                                                  //
+  USART_ICR(USART1) = USART_ICR_ORECF;               // ORE also raises the IRQ
+}
+
+void rtc_alarm_isr(void) {
+  rtc_clear_isr_flag(RTC_ISR_ALRAF);                 // Waking is all it does;
+  exti_reset_request(EXTI18);                        //  see run_cmd_queue
+}
+
+void rtc_wkup_isr(void) {
+  rtc_clear_isr_flag(RTC_ISR_WUTF);                  //
+  exti_reset_request(EXTI20);                        //
+  rtc_sec += 1;                                      // One calendar second
+}
+
+void tim1_up_tim16_isr(void) {
+  if(timer_get_flag(TIM16,TIM_SR_CC1OF)) {           // Missed a capture, so
+    timer_clear_flag(TIM16,TIM_SR_CC1OF);            //  start over from the
+    lsi_cal_count = 0;                               //  latest one
+    lsi_cal_cycles = 0;                              //
+  }                                                  //
+  if(timer_get_flag(TIM16,TIM_SR_CC1IF)) {           //
+    uint32_t capture = TIM_CCR1(TIM16);              // Read clears CC1IF
+    if(lsi_cal_count>0) {                            // ~20000 cycles apart, so
+      lsi_cal_cycles += (capture-lsi_cal_last)&0xffff; // one wrap at most
+    }                                                //
+    lsi_cal_last = capture;                          //
+    lsi_cal_count += 1;                              //
+    if(lsi_cal_count>LSI_CAL_CAPTURES) {             // Intervals, not captures
+      timer_disable_irq(TIM16,TIM_DIER_CC1IE);       //
+      lsi_cal_done = 1;                              //
+    }                                                //
+  }                                                  //
+}
+
 // Task-like functions
 
 void rx_usart1(rx_cmd_buff_t* rx_cmd_buff_o) {
   while(                                             // while
-   usart_get_flag(USART1,USART_ISR_RXNE) &&          //  USART1 RX not empty AND
+   rx_ring_tail!=rx_ring_head &&                     //  RX ring not empty AND
    rx_cmd_buff_o->state!=RX_CMD_BUFF_STATE_COMPLETE  //  Command not complete
   ) {                                                //
-    uint8_t b = usart_recv(USART1);                  // Receive byte from RX pin
+    if(sleep_woke) {                                 // First byte after wake
+      uint32_t latency = (uint32_t)(now_cycles()-sleep_wake_cycles);
+      sleep_stats.wake_latency_last = latency;       //
+      if(latency>sleep_stats.wake_latency_max) {     //
+        sleep_stats.wake_latency_max = latency;      //
+      }                                              //
+      sleep_woke = 0;                                //
+    }                                                //
+    uint8_t b = rx_ring[rx_ring_tail];               // Pop byte from RX ring
+    rx_cmd_cycles = rx_ring_cycles[rx_ring_tail];    //  and its arrival time
+    rx_ring_tail = (rx_ring_tail+1)&(RX_RING_SIZE-1);//
     push_rx_cmd_buff(rx_cmd_buff_o, b);              // Push byte to buffer
   }                                                  //
 }
 
+void baud_usart1(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
+  if(                                                // if
+   uart_baud_pending &&                              //  Baud change pending AND
+   tx_cmd_buff_o->empty &&                           //  TX buffer empty AND
+   usart_get_flag(USART1,USART_ISR_TC)               //  Last ACK bit sent
+  ) {                                                //
+    set_uart_baud(uart_baud_pending);                // Switch baud rate
+    TRACE1(TRACE_EVENT_BAUD, uart_baud_pending);     //
+    uart_baud_pending = 0;                           //
+    uart_baud_unconfirmed = (uart_baud!=UART_BAUD_DEFAULT);
+    uart_baud_changed = now_cycles();                // Start fallback timer
+    clear_rx_cmd_buff(rx_cmd_buff_o);                // Drop partial command
+  } else if(uart_baud_unconfirmed) {                 // Waiting on new baud
+    if(rx_cmd_buff_o->state==RX_CMD_BUFF_STATE_COMPLETE) {
+      uart_baud_unconfirmed = 0;                     // Valid cmd; keep baud
+    } else if(                                       // No valid cmd in time
+     now_cycles()-uart_baud_changed >
+     cycles_from_ms(UART_BAUD_TIMEOUT_MS)
+    ) {                                              //
+      TRACE1(TRACE_EVENT_BAUD_FALLBACK, uart_baud);  //
+      set_uart_baud(UART_BAUD_DEFAULT);              // Fall back
+      uart_baud_unconfirmed = 0;                     //
+      clear_rx_cmd_buff(rx_cmd_buff_o);              // Drop garbled bytes
+    }                                                //
+  }                                                  //
+}
+
 void reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
   if(                                                  // if
    rx_cmd_buff_o->state==RX_CMD_BUFF_STATE_COMPLETE && // rx_cmd is valid AND
    tx_cmd_buff_o->empty                                // tx_cmd is empty
   ) {                                                  //
+    TRACE2(                                            // Command received
+     TRACE_EVENT_CMD, rx_cmd_buff_o->data[OPCODE_INDEX],
+     (rx_cmd_buff_o->data[MSG_ID_MSB_INDEX]<<8) |
+     rx_cmd_buff_o->data[MSG_ID_LSB_INDEX]
+    );                                                 //
     write_reply(rx_cmd_buff_o, tx_cmd_buff_o);         // execute cmd and reply
+    if(!(tx_cmd_buff_o->empty)) {                      // Reply queued
+      TRACE2(
+       TRACE_EVENT_REPLY, tx_cmd_buff_o->data[OPCODE_INDEX],
+       tx_cmd_buff_o->data[MSG_LEN_INDEX]
+      );
+    }                                                  //
   }                                                    //
 }
 
@@ -792,7 +1306,159 @@ void tx_usart1(tx_cmd_buff_t* tx_cmd_buff_o) {
    usart_get_flag(USART1,USART_ISR_TXE) &&           //  USART1 TX empty AND
    !(tx_cmd_buff_o->empty)                           //  TX buffer not empty
   ) {                                                //
+    if(                                              // if
+     tx_cmd_buff_o->start_index==0 &&                //  First byte AND
+     tx_cmd_buff_o->data[OPCODE_INDEX]==APP_TIME_STAMPS_OPCODE // time stamps
+    ) {                                              //
+      uint32_t sec = 0;                              // Stamp the reply as it
+      uint32_t ns = 0;                               //  starts out; the stamp
+      get_rtc(&sec,&ns);                             //  bytes go later
+      pack_uint32(
+       (tx_cmd_buff_o->data)+DATA_START_INDEX+TIME_STAMPS_TX_OFFSET, sec
+      );
+      pack_uint32(
+       (tx_cmd_buff_o->data)+DATA_START_INDEX+TIME_STAMPS_TX_OFFSET+4, ns
+      );
+    }                                                //
     uint8_t b = pop_tx_cmd_buff(tx_cmd_buff_o);      // Pop byte from TX buffer
     usart_send(USART1,b);                            // Send byte to TX pin
   }                                                  //
 }
+
+void run_cmd_queue(
+ rx_cmd_buff_t* rx_cmd_buff_o, const tx_cmd_buff_t* tx_cmd_buff_o
+) {
+  const cmd_queue_entry_t* next = cmd_queue_entry(0);
+  uint32_t sec = 0;
+  uint32_t ns = 0;
+  if(next==NULL || !get_rtc(&sec,&ns)) {            // Nothing to run, or no
+    if(rtc_alarm_sec!=RTC_ALARM_NONE) {             //  time to run it by
+      clear_rtc_alarm();
+    }
+  } else if(next->exec_sec>sec) {                   // Not due; keep Alarm A
+    if(rtc_alarm_sec!=next->exec_sec) {             //  on the earliest entry
+      set_rtc_alarm(next->exec_sec);
+    }
+  } else if(                                        // Due, and no uplinked
+   rx_cmd_buff_o->state==RX_CMD_BUFF_STATE_START_BYTE_0 && // command is being
+   tx_cmd_buff_o->empty                             //  received or answered
+  ) {
+    uint16_t id = next->id;
+    uint32_t exec_sec = next->exec_sec;
+    uint8_t len = next->len;
+    for(size_t i=0; i<len; i++) {                   // Hand the frame to reply
+      rx_cmd_buff_o->data[i] = next->frame[i];      //  as if it had just come
+    }                                               //  in over USART1
+    if(cmd_queue_delete(id)) {                      // Logged first: runs once;
+      rx_cmd_buff_o->start_index = len;             //  else retried next pass
+      rx_cmd_buff_o->end_index = len;
+      rx_cmd_buff_o->state = RX_CMD_BUFF_STATE_COMPLETE;
+      rx_cmd_cycles = (uint32_t)now_cycles();      // Received just now
+      TRACE2(TRACE_EVENT_QUEUE_RUN, id, exec_sec);
+    }
+  }
+}
+
+void confirm_slot(void) {
+  iwdg_reset();                                      // No-op unless started
+  if(                                                // if
+   !slot_confirmed &&                                //  Not yet confirmed AND
+   now_cycles()>=cycles_from_ms(SLOT_CONFIRM_MS)     //  Loop ran long enough
+  ) {                                                //
+    if(!slot_confirm_running()) {                    // Keep this slot; else
+      TRACE2(                                        //  it falls back at the
+       TRACE_EVENT_SLOT_FAIL,                        //  next reset
+       SLOT_RECORD_CONFIRM, slot_mapped()            //
+      );                                             //
+    }                                                //
+    slot_confirmed = 1;                              //
+  }                                                  //
+}
+
+void slew_rtc(void) {
+  if(rtc_slew_ticks!=0 && rtc_sec!=rtc_slew_sec) { // One tick each second
+    int32_t ticks = (rtc_slew_ticks>0) ? 1 : -1;
+    shift_rtc(ticks);
+    rtc_slew_ticks -= ticks;
+    rtc_slew_sec = rtc_sec;
+  }
+}
+
+void run_jobs(void) {
+  jobs_tick(rtc_sec);                             // rtc_wkup_isr wakes the
+  uint8_t id = jobs_next();                       //  loop every second
+  if(id!=JOB_NONE) {                              // One job per pass, so
+    uint64_t start = now_cycles();                //  commands still get
+    switch(id) {                                  //  answered in between
+      case JOB_LSI_CAL:
+        lsi_cal_due = 1;                          // calibrate_lsi starts it
+        break;
+      case JOB_EPHEMERIS:
+        refresh_ephemeris();
+        break;
+      case JOB_BEACON:
+        TRACE2(TRACE_EVENT_BEACON, sleep_stats.sleep_count, jobs_overruns());
+        break;
+      default:
+        break;
+    }
+    jobs_done(
+     id, (uint32_t)((now_cycles()-start)/(rcc_ahb_frequency/1000000))
+    );
+  }
+}
+
+void calibrate_lsi(void) {
+  if(lsi_cal_running) {
+    if(lsi_cal_done) {
+      timer_disable_counter(TIM16);
+      nvic_disable_irq(NVIC_TIM1_UP_TIM16_IRQ);
+      rcc_periph_clock_disable(RCC_TIM16);
+      lsi_cal_running = 0;
+      // timer cycles expected at exactly LSI_FREQ_NOMINAL, and measured
+      uint64_t expected = ((uint64_t)LSI_CAL_CAPTURES)*8*
+       (rcc_apb2_frequency/LSI_FREQ_NOMINAL);
+      uint64_t measured = lsi_cal_cycles;
+      lsi_ppm = (int32_t)((expected*1000000+measured/2)/measured)-1000000;
+      // 1 Hz needs f_LSI/(RTC_PREDIV_A+1) synchronous prescaler counts; set_rtc
+      // applies the best whole number, smooth calibration trims what is left
+      uint64_t ck_apre = LSI_FREQ_NOMINAL/(RTC_PREDIV_A+1);
+      lsi_prediv_s = (uint32_t)((expected*ck_apre+measured/2)/measured)-1;
+      int32_t rtc_ppm = (int32_t)(
+       (expected*ck_apre*1000000)/(measured*(rtc_prediv_s+1))
+      )-1000000;
+      rtc_smooth_calibrate(rtc_ppm);
+      TRACE2(TRACE_EVENT_LSI_CAL, (uint32_t)lsi_ppm, (uint32_t)rtc_ppm);
+    }
+  } else if(lsi_cal_due) {                          // Set by JOB_LSI_CAL too
+    start_lsi_cal();
+  }
+}
+
+void sleep_usart1(
+ const rx_cmd_buff_t* rx_cmd_buff_o, const tx_cmd_buff_t* tx_cmd_buff_o
+) {
+  // Nothing wakes the core when the fallback timer expires, so stay awake
+  // while it runs
+  cm_disable_interrupts();                           // Pending IRQ still wakes
+  if(                                                // if
+   rx_ring_tail==rx_ring_head &&                     //  RX ring empty AND
+   rx_cmd_buff_o->state!=RX_CMD_BUFF_STATE_COMPLETE && // No cmd to reply to AND
+   tx_cmd_buff_o->empty &&                           //  TX buffer empty AND
+   !uart_baud_pending &&                             //  No baud change AND
+   !uart_baud_unconfirmed &&                         //  No fallback timer AND
+   !app_jump_pending &&                              //  No jump pending AND
+   !jobs_pending()                                   //  No job waiting to run
+  ) {                                                //
+    __asm__ volatile("wfi");                         // Sleep until interrupt
+    sleep_wake_cycles = now_cycles();                //
+    cm_enable_interrupts();                          // Run the waking ISR
+    if(rx_ring_tail!=rx_ring_head) {                 // Woken by USART1 RX
+      sleep_stats.sleep_count += 1;                  //
+      TRACE0(TRACE_EVENT_WAKE);                      //
+      sleep_woke = 1;                                //
+    }                                                //
+  } else {                                           //
+    cm_enable_interrupts();                          //
+  }                                                  //
+}
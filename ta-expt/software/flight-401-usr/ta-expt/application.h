@@ -17,12 +17,45 @@
 //// Application start address
 #define APP_ADDR   ((uint32_t)0x08008000U)
 
+//// Application flash pages; subpage IDs 0x00 to 0xff span the 16 pages from
+//// APP_ADDR (page 16 of the slot's bank) through the start of page 32
+#define APP_MAX_PAGES ((uint32_t)16)
+
 //// SRAM1 start address
 #define SRAM1_BASE ((uint32_t)0x20000000U)
 
 //// SRAM1 size
 #define SRAM1_SIZE ((uint32_t)0x00040000U)
 
+//// USART1 baud rate after reset and after an unconfirmed baud rate change
+#define UART_BAUD_DEFAULT    ((uint32_t)115200U)
+
+//// Time allowed at a new baud rate for a valid command to arrive
+#define UART_BAUD_TIMEOUT_MS ((uint32_t)2000U)
+
+//// USART1 RX ring buffer size; must be a power of two
+#define RX_RING_SIZE ((size_t)512)
+
+//// RTC prescalers for the 32 kHz LSI: 32 kHz/(31+1) = 1 kHz subsecond ticks,
+//// 1 kHz/(999+1) = 1 Hz calendar; set_rtc trims RTC_PREDIV_S to the LSI
+//// frequency last measured by calibrate_lsi
+#define RTC_PREDIV_A ((uint32_t)31)
+#define RTC_PREDIV_S ((uint32_t)999)
+
+//// LSI calibration; TIM16 captures every 8th LSI edge (TI1 remapped to LSI
+//// through TIM16_OR1) against the 80 MHz timer clock, which comes from HSI16
+#define LSI_FREQ_NOMINAL      ((uint32_t)32000U)
+#define LSI_CAL_CAPTURES      ((uint32_t)128)   // 1024 LSI cycles, ~32 ms
+#define TIM16_OR1_OFFSET      ((uint32_t)0x50)
+#define TIM16_OR1_TI1_RMP_LSI ((uint32_t)0x1)
+
+//// rtc_alarm_sec while Alarm A is off
+#define RTC_ALARM_NONE ((uint32_t)0xffffffff)
+
+//// adjust_rtc slews offsets up to this size by one subsecond tick per second
+//// (1000 ppm with 1 ms ticks) and steps larger ones at once
+#define RTC_SLEW_THRESHOLD_NS ((int32_t)128000000)
+
 //// Constants
 #define HOUR_PER_DAY         ((uint8_t)24)            // hours per day
 #define MIN_PER_HOUR         ((uint8_t)60)            // minutes per hour
@@ -79,8 +112,61 @@ typedef struct eci_posn {
   float z;
 } eci_posn_t;
 
+//// SGP4 quantities that depend only on the TLE; set once by sgp4_init so
+//// sgp4_propagate only does the time-dependent work. Names follow sgp4_init
+typedef struct sgp4_state {
+  int   isimp;       // Non-zero if perigee is below 220 km; drops d2-d4, c5
+  float bstar;       // inverse Earth radians
+  float i0;          // inclination in radians
+  float o0;          // right ascension of node in radians
+  float e0;          // eccentricity (unitless)
+  float w0;          // argument of perigee in radians
+  float m0;          // mean anomaly in radians
+  float n0pp;        // recovered mean motion in radians per minute
+  float a0pp;        // recovered semimajor axis in Earth radii
+  float cosi0;
+  float sini0;
+  float thetar2;
+  float thetar2t3m1; // X3THM1
+  float nthetar2a1;  // X1MTH2
+  float mdt;         // mean anomaly rate in radians per minute
+  float wdt;         // argument of perigee rate in radians per minute
+  float odt;         // node rate in radians per minute
+  float uo;          // node drag term; times tsince squared
+  float c1;
+  float c1r2;
+  float c4;
+  float c5;
+  float d2;
+  float d3;
+  float d4;
+  float eta;
+  float deltawc;     // OMGCOF; deltaw per minute
+  float deltamc;     // XMCOF
+  float deltam0;     // DELMO; (1+eta*cos(m0))^3
+  float sinm0;       // SINMO
+  float ull;         // XLCOF
+  float uaynl;       // AYCOF
+} sgp4_state_t;
+
+//// sleep-on-idle statistics; wake latency is in CPU cycles from the end of
+//// WFI to the first byte handed to push_rx_cmd_buff
+typedef struct sleep_stats {
+  uint32_t sleep_count;       // Number of WFI sleeps that ended on USART1 RX
+  uint32_t wake_latency_last; // Wake-to-first-byte latency of the last wake
+  uint32_t wake_latency_max;  // Largest wake-to-first-byte latency seen
+} sleep_stats_t;
+
 // Initialization functions
 
+/*  uint32_t init_handoff(void)
+ *    Takes over the state the bootloader left set up, as described by the
+ *    handoff block; call first and skip the init functions it covers
+ *  Return:
+ *    HANDOFF_FLAG_* bits for the state taken over; 0 if there was no handoff
+ */
+uint32_t init_handoff(void);
+
 void init_clock(void);
 void init_led(void);
 void init_uart(void);
@@ -88,9 +174,24 @@ void init_rtc(void);
 
 // Utility functions
 
+/*  int uart_baud_supported(const uint32_t baud)
+ *    baud: requested USART1 baud rate
+ *  Return:
+ *    0 to indicate baud is not supported
+ *    Non-zero to indicate baud is supported
+ */
+int uart_baud_supported(const uint32_t baud);
+
+/*  void set_uart_baud(const uint32_t baud)
+ *    baud: new USART1 baud rate; any byte still in the TX FIFO is lost, so
+ *          wait for USART_ISR_TC first
+ */
+void set_uart_baud(const uint32_t baud);
+
 /*  int set_rtc(const int32_t sec, const int32_t ns)
  *    sec: seconds since J2000
- *    ns:  any additional nanoseconds
+ *    ns:  any additional nanoseconds, kept to the RTC subsecond resolution;
+ *         waits up to one second for RTC_SSR to allow the subsecond shift
  *  Return:
  *    0 to indicate failure
  *    Non-zero to indicate success
@@ -107,12 +208,45 @@ int set_rtc(const uint32_t sec, const uint32_t ns);
 int get_rtc(uint32_t* sec, uint32_t* ns);
 
 /*  date_time_t get_date_time_rtc(void)
- *    void: no function parameters
+ *    void: no function parameters; computed from the cached RTC seconds, or
+ *          2000-01-01 11:58:56 if the RTC has not been set
  *  Return:
  *    date_time_t struct
  */
 date_time_t get_date_time_rtc(void);
 
+/*  void set_rtc_alarm(const uint32_t sec)
+ *    sec: seconds since J2000; RTC Alarm A fires at the first calendar second
+ *         at or after it and wakes the MCU. Only the day of the month is
+ *         compared, so the caller checks the time when the alarm fires
+ */
+void set_rtc_alarm(const uint32_t sec);
+
+/*  void clear_rtc_alarm(void)
+ *    Turns RTC Alarm A off
+ */
+void clear_rtc_alarm(void);
+
+/*  int get_rtc_rx_stamp(uint32_t* sec, uint32_t* ns)
+ *    sec: Upon return, RTC seconds since J2000 when the last byte of the
+ *         command being answered arrived at USART1
+ *    ns:  Upon return, contains any additional nanoseconds
+ *  Return:
+ *    0 to indicate failure (e.g. RTC has not been set)
+ *    Non-zero to indicate success (sec and ns contain valid values)
+ */
+int get_rtc_rx_stamp(uint32_t* sec, uint32_t* ns);
+
+/*  int adjust_rtc(const int32_t offset_ns)
+ *    offset_ns: correction to add to the RTC, under a second either way;
+ *               applied through RTC_SHIFTR, so the RTC keeps running.
+ *               Up to RTC_SLEW_THRESHOLD_NS it is slewed by slew_rtc
+ *  Return:
+ *    0 to indicate failure (RTC not set or offset too large)
+ *    Non-zero to indicate success
+ */
+int adjust_rtc(const int32_t offset_ns);
+
 // Application functions
 
 /*  tle_t parse_tle(char* start)
@@ -158,30 +292,36 @@ uint32_t calc_julian_day_from_ymd(
  */
 float calc_tdiff_minute(const date_time_t* event, const date_time_t* epoch);
 
-/* eci_posn_t sgp4(
- *  const float bstar, const float i0, const float o0, const float e0,
- *  const float w0, const float m0, const float n0, const float tsince
- * )
- *    bstar:  inverse Earth radians
- *    i0:     inclination in radians
- *    o0:     right ascension of node in radians
- *    e0:     eccentricity (unitless)
- *    w0:     argument of perigee in radians
- *    m0:     mean anomaly in radians
- *    n0:     mean_motion in radians per minute
+/*  void sgp4_init(const tle_t* tle, sgp4_state_t* state_o)
+ *    tle:     tle_t struct, as from parse_tle
+ *    state_o: upon return, the SGP4 quantities that depend only on tle; run
+ *             once per TLE
+ */
+void sgp4_init(const tle_t* tle, sgp4_state_t* state_o);
+
+/*  eci_posn_t sgp4_propagate(const sgp4_state_t* state, const float tsince)
+ *    state:  sgp4_state_t struct set by sgp4_init
  *    tsince: minutes since TLE epoch
  *  Return:
  *    eci_posn_t struct representing the ECI position of the satellite
  */
-eci_posn_t sgp4(
- const float bstar, const float i0, const float o0, const float e0,
- const float w0, const float m0, const float n0, const float tsince
-);
+eci_posn_t sgp4_propagate(const sgp4_state_t* state, const float tsince);
 
 // Task-like functions
 
 void rx_usart1(rx_cmd_buff_t* rx_cmd_buff_o);
+void baud_usart1(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o);
 void reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o);
 void tx_usart1(tx_cmd_buff_t* tx_cmd_buff_o);
+void run_cmd_queue(
+ rx_cmd_buff_t* rx_cmd_buff_o, const tx_cmd_buff_t* tx_cmd_buff_o
+);
+void confirm_slot(void);
+void slew_rtc(void);
+void run_jobs(void);
+void calibrate_lsi(void);
+void sleep_usart1(
+ const rx_cmd_buff_t* rx_cmd_buff_o, const tx_cmd_buff_t* tx_cmd_buff_o
+);
 
 #endif
@@ -0,0 +1,60 @@
+// boot_record.c
+// Tartan Artibeus EXPT board boot record implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                 // size_t
+#include <stdint.h>                 // uint32_t
+
+// libopencm3 library
+#include <libopencm3/cm3/dwt.h>     // used in init_boot_record, mark
+
+// ta-expt library
+#include <boot_record.h>            // Header file
+
+// Variables
+
+//// Boot record in no-init SRAM2
+static volatile boot_record_t* const boot_record =
+ (volatile boot_record_t*)BOOT_RECORD_ADDR;
+
+// Boot record functions
+
+void init_boot_record(void) {
+  dwt_enable_cycle_counter();
+  DWT_CYCCNT = 0;                       // Not cleared by a system reset
+  for(size_t i=0; i<BOOT_MARK_COUNT; i++) {
+    boot_record->marks[i] = 0;
+  }
+  boot_record->version = BOOT_RECORD_VERSION;
+  boot_record->magic = BOOT_RECORD_MAGIC;
+  boot_record_mark(BOOT_MARK_BLR_START);
+}
+
+int boot_record_valid(void) {
+  return
+   boot_record->magic==BOOT_RECORD_MAGIC &&
+   boot_record->version==BOOT_RECORD_VERSION;
+}
+
+void boot_record_mark(const boot_mark_t mark) {
+  if(boot_record_valid() && mark<BOOT_MARK_COUNT) {
+    uint32_t cycles = dwt_read_cycle_counter();
+    boot_record->marks[mark] = (cycles!=0) ? cycles : 1; // 0 means unset
+  }
+}
+
+uint32_t boot_record_cycles(const boot_mark_t from, const boot_mark_t to) {
+  if(
+   boot_record_valid() && from<BOOT_MARK_COUNT && to<BOOT_MARK_COUNT &&
+   boot_record->marks[from]!=0 && boot_record->marks[to]!=0
+  ) {
+    return boot_record->marks[to]-boot_record->marks[from];
+  } else {
+    return 0;
+  }
+}
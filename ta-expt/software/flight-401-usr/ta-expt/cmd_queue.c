@@ -0,0 +1,240 @@
+// cmd_queue.c
+// Tartan Artibeus EXPT board time-tagged command queue implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                 // size_t, NULL
+#include <stdint.h>                 // uint8_t, uint16_t, uint32_t
+
+// libopencm3 library
+#include <libopencm3/stm32/flash.h> // used in cmd_queue_append, flush
+
+// ta-expt library
+#include <cmd_queue.h>              // Header file
+#include <crc32.h>                  // used to seal log records
+#include <slots.h>                  // slot_mapped, slot_erase_page,
+                                    //  slot_program_log
+
+// Variables
+
+//// Queue in execution order; entries due at the same time keep their order
+cmd_queue_entry_t cmd_queue[CMD_QUEUE_LEN];
+uint32_t cmd_queue_len = 0;     // Entries in cmd_queue
+uint32_t cmd_queue_records = 0; // Records in the queue log, torn ones too
+uint16_t cmd_queue_next_id = 0; // ID given to the next entry
+
+// Helper functions
+
+//// Address of the queue log in the current memory map
+static uint32_t cmd_queue_log_addr(void) {
+  uint32_t bank1 = (slot_mapped()==SLOT_B) ? SLOT_BANK_SIZE : 0;
+  return SLOT_FLASH_BASE+bank1+CMD_QUEUE_LOG_OFFSET;
+}
+
+//// Seal over the first 124 bytes of a record
+static uint32_t cmd_queue_seal(const cmd_queue_record_t* record) {
+  return crc32(0, (const uint8_t*)record, sizeof(cmd_queue_record_t)-4);
+}
+
+//// Non-zero if the record at index holds a valid sealed record
+static int cmd_queue_read_record(
+ const uint32_t index, cmd_queue_record_t* record_o
+) {
+  const cmd_queue_record_t* src = (const cmd_queue_record_t*)(
+   cmd_queue_log_addr()+index*sizeof(cmd_queue_record_t)
+  );
+  *record_o = *src;
+  return
+   record_o->magic==CMD_QUEUE_RECORD_MAGIC &&
+   record_o->len<=CMD_QUEUE_FRAME_MAX &&
+   record_o->seal==cmd_queue_seal(record_o);
+}
+
+//// Programs a record for entry at index; flash must be unlocked
+static int cmd_queue_program_record(
+ const uint32_t index, const uint8_t type, const cmd_queue_entry_t* entry
+) {
+  cmd_queue_record_t record = {
+   .magic     = CMD_QUEUE_RECORD_MAGIC,
+   .type      = type,
+   .len       = (type==CMD_QUEUE_RECORD_ADD) ? entry->len : 0,
+   .reserved  = 0xff,
+   .id        = entry->id,
+   .reserved2 = 0xffff,
+   .exec_sec  = (type==CMD_QUEUE_RECORD_ADD) ? entry->exec_sec : 0,
+   .frame     = {0},
+   .seal      = 0
+  };
+  for(size_t i=0; i<record.len; i++) {
+    record.frame[i] = entry->frame[i];
+  }
+  record.seal = cmd_queue_seal(&record);
+  return slot_program_log(
+   cmd_queue_log_addr()+index*sizeof(cmd_queue_record_t),
+   &record, sizeof(record)
+  );
+}
+
+//// Erases the queue log and writes back the queue in RAM: a FLUSH record with
+//// the next ID, so IDs are not reused, then one ADD record per entry; flash
+//// must be unlocked
+static int cmd_queue_compact(void) {
+  cmd_queue_entry_t next = {.exec_sec = 0, .id = cmd_queue_next_id, .len = 0};
+  slot_erase_page(CMD_QUEUE_LOG_PAGE);
+  cmd_queue_records = 0;
+  int success =
+   cmd_queue_program_record(cmd_queue_records++, CMD_QUEUE_RECORD_FLUSH, &next);
+  for(uint32_t i=0; i<cmd_queue_len && success; i++) {
+    success = cmd_queue_program_record(
+     cmd_queue_records++, CMD_QUEUE_RECORD_ADD, &cmd_queue[i]
+    );
+  }
+  return success;
+}
+
+//// Logs a change that has already been made in RAM; if the log is full it is
+//// compacted, which covers the change too. Returns 0 if a record could not be
+//// written
+static int cmd_queue_append(
+ const uint8_t type, const cmd_queue_entry_t* entry
+) {
+  int success = 0;
+  flash_unlock();
+  if(cmd_queue_records>=CMD_QUEUE_LOG_SIZE/sizeof(cmd_queue_record_t)) {
+    success = cmd_queue_compact();
+  } else {
+    success = cmd_queue_program_record(cmd_queue_records++, type, entry);
+  }
+  flash_lock();
+  return success;
+}
+
+//// Inserts an entry after any entries due at or before exec_sec; returns 0
+//// if the queue is full
+static int cmd_queue_insert(
+ const uint32_t exec_sec, const uint16_t id,
+ const uint8_t* frame, const uint8_t len
+) {
+  if(cmd_queue_len>=CMD_QUEUE_LEN || len>CMD_QUEUE_FRAME_MAX) {
+    return 0;
+  }
+  uint32_t pos = cmd_queue_len;
+  while(pos>0 && cmd_queue[pos-1].exec_sec>exec_sec) {
+    cmd_queue[pos] = cmd_queue[pos-1];
+    pos -= 1;
+  }
+  cmd_queue[pos].exec_sec = exec_sec;
+  cmd_queue[pos].id = id;
+  cmd_queue[pos].len = len;
+  for(size_t i=0; i<len; i++) {
+    cmd_queue[pos].frame[i] = frame[i];
+  }
+  cmd_queue_len += 1;
+  return 1;
+}
+
+//// Removes the entry with this ID and returns a copy in entry_o; returns 0 if
+//// there is none
+static int cmd_queue_remove(const uint16_t id, cmd_queue_entry_t* entry_o) {
+  for(uint32_t pos=0; pos<cmd_queue_len; pos++) {
+    if(cmd_queue[pos].id==id) {
+      *entry_o = cmd_queue[pos];
+      for(uint32_t i=pos+1; i<cmd_queue_len; i++) {
+        cmd_queue[i-1] = cmd_queue[i];
+      }
+      cmd_queue_len -= 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Command queue functions
+
+void cmd_queue_load(void) {
+  cmd_queue_len = 0;
+  cmd_queue_records = 0;
+  cmd_queue_next_id = 0;
+  cmd_queue_record_t record;
+  cmd_queue_entry_t removed;
+  uint32_t capacity = CMD_QUEUE_LOG_SIZE/sizeof(cmd_queue_record_t);
+  for(uint32_t i=0; i<capacity; i++) {
+    const uint32_t* raw =
+     (const uint32_t*)(cmd_queue_log_addr()+i*sizeof(cmd_queue_record_t));
+    if(raw[0]==0xffffffff && raw[1]==0xffffffff) {
+      break;                                  // End of log
+    }
+    cmd_queue_records = i+1;                  // Torn records still use space
+    if(!cmd_queue_read_record(i, &record)) {
+      continue;
+    }
+    if(record.type==CMD_QUEUE_RECORD_FLUSH) {
+      cmd_queue_len = 0;                      // Entries before it are gone,
+      cmd_queue_next_id = record.id;          //  but their IDs stay used
+    } else {
+      if(record.type==CMD_QUEUE_RECORD_ADD) {
+        cmd_queue_insert(record.exec_sec, record.id, record.frame, record.len);
+      } else if(record.type==CMD_QUEUE_RECORD_REMOVE) {
+        cmd_queue_remove(record.id, &removed);
+      }
+      if(record.id>=cmd_queue_next_id) {
+        cmd_queue_next_id = (uint16_t)(record.id+1);
+      }
+    }
+  }
+}
+
+int cmd_queue_add(
+ const uint32_t exec_sec, const uint8_t* frame, const uint8_t len,
+ uint16_t* id_o
+) {
+  uint16_t id = cmd_queue_next_id;
+  if(!cmd_queue_insert(exec_sec, id, frame, len)) {
+    return 0;
+  }
+  cmd_queue_next_id += 1;                     // Not reused even on failure
+  int success = 0;
+  for(uint32_t pos=0; pos<cmd_queue_len; pos++) {
+    if(cmd_queue[pos].id==id) {
+      success = cmd_queue_append(CMD_QUEUE_RECORD_ADD, &cmd_queue[pos]);
+    }
+  }
+  cmd_queue_entry_t removed;
+  if(!success) {
+    cmd_queue_remove(id, &removed);           // Keep RAM and log in step
+  }
+  *id_o = id;
+  return success;
+}
+
+int cmd_queue_delete(const uint16_t id) {
+  cmd_queue_entry_t removed;
+  if(!cmd_queue_remove(id, &removed)) {
+    return 0;
+  }
+  int success = cmd_queue_append(CMD_QUEUE_RECORD_REMOVE, &removed);
+  if(!success) {
+    cmd_queue_insert(removed.exec_sec, removed.id, removed.frame, removed.len);
+  }
+  return success;
+}
+
+int cmd_queue_flush(void) {
+  cmd_queue_len = 0;
+  flash_unlock();
+  int success = cmd_queue_compact();
+  flash_lock();
+  return success;
+}
+
+uint32_t cmd_queue_count(void) {
+  return cmd_queue_len;
+}
+
+const cmd_queue_entry_t* cmd_queue_entry(const uint32_t index) {
+  return (index<cmd_queue_len) ? &cmd_queue[index] : NULL;
+}
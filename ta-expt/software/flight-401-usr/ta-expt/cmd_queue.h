@@ -0,0 +1,110 @@
+// cmd_queue.h
+// Tartan Artibeus EXPT board time-tagged command queue header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef CMD_QUEUE_H
+#define CMD_QUEUE_H
+
+// Standard library
+#include <stdint.h> // uint8_t, uint16_t, uint32_t
+
+// Macros
+
+//// Queue size; entries are kept in RAM sorted by execution time
+#define CMD_QUEUE_LEN       ((uint32_t)8)
+#define CMD_QUEUE_FRAME_MAX ((uint8_t)112) // Whole TAOLST frame, start bytes on
+
+//// Queue log; page 33 of bank 1, just past the slot log. Records are appended
+//// in order and the page is compacted when full, as with the slot log
+#define CMD_QUEUE_LOG_PAGE   ((uint32_t)33)
+#define CMD_QUEUE_LOG_OFFSET ((uint32_t)0x00010800U) // From start of bank 1
+#define CMD_QUEUE_LOG_SIZE   ((uint32_t)2048)
+
+//// Queue log record types
+#define CMD_QUEUE_RECORD_MAGIC  ((uint8_t)0x5a)
+#define CMD_QUEUE_RECORD_ADD    ((uint8_t)0x01) // Entry queued
+#define CMD_QUEUE_RECORD_REMOVE ((uint8_t)0x02) // Entry executed or deleted
+#define CMD_QUEUE_RECORD_FLUSH  ((uint8_t)0x03) // Log restarted; id is next ID
+
+// Typedefs
+
+//// Queue entry
+typedef struct cmd_queue_entry {
+  uint32_t exec_sec;                   // Execution time; seconds since J2000
+  uint16_t id;                         // Assigned by cmd_queue_add
+  uint8_t  len;                        // Frame length in bytes
+  uint8_t  frame[CMD_QUEUE_FRAME_MAX]; // TAOLST frame to dispatch
+} cmd_queue_entry_t;
+
+//// Queue log record; 16 double words, written by slot_program_log
+typedef struct cmd_queue_record {
+  uint8_t  magic;                      // CMD_QUEUE_RECORD_MAGIC
+  uint8_t  type;                       // CMD_QUEUE_RECORD_*
+  uint8_t  len;                        // CMD_QUEUE_RECORD_ADD only; else 0
+  uint8_t  reserved;                   // 0xff
+  uint16_t id;                         // Entry ID; next ID for FLUSH
+  uint16_t reserved2;                  // 0xffff
+  uint32_t exec_sec;                   // CMD_QUEUE_RECORD_ADD only; else 0
+  uint8_t  frame[CMD_QUEUE_FRAME_MAX]; // CMD_QUEUE_RECORD_ADD only
+  uint32_t seal;                       // crc32 of the preceding 124 bytes
+} cmd_queue_record_t;
+
+// Command queue functions
+
+/*  void cmd_queue_load(void)
+ *    Rebuilds the queue in RAM by replaying the queue log
+ */
+void cmd_queue_load(void);
+
+/*  int cmd_queue_add(
+ *   const uint32_t exec_sec, const uint8_t* frame, const uint8_t len,
+ *   uint16_t* id_o
+ *  )
+ *    exec_sec: execution time in seconds since J2000
+ *    frame:    TAOLST frame of len bytes, at most CMD_QUEUE_FRAME_MAX
+ *    id_o:     upon return, the ID assigned to the new entry
+ *  Return:
+ *    0 to indicate failure (queue full, frame too long or the record could
+ *    not be written); the queue is left as it was
+ *    Non-zero to indicate success
+ */
+int cmd_queue_add(
+ const uint32_t exec_sec, const uint8_t* frame, const uint8_t len,
+ uint16_t* id_o
+);
+
+/*  int cmd_queue_delete(const uint16_t id)
+ *  Return:
+ *    0 to indicate there is no entry with this ID, or the record could not be
+ *    written and the entry is still queued
+ *    Non-zero to indicate the entry was removed
+ */
+int cmd_queue_delete(const uint16_t id);
+
+/*  int cmd_queue_flush(void)
+ *    Removes every entry and erases the queue log, which then restarts with
+ *    the next ID so that IDs are never handed out twice
+ *  Return:
+ *    0 to indicate the restarted log could not be written
+ *    Non-zero to indicate success
+ */
+int cmd_queue_flush(void);
+
+/*  uint32_t cmd_queue_count(void)
+ *  Return:
+ *    Number of queued entries
+ */
+uint32_t cmd_queue_count(void);
+
+/*  const cmd_queue_entry_t* cmd_queue_entry(const uint32_t index)
+ *    index: position in execution order; 0 is the earliest entry
+ *  Return:
+ *    The entry, or NULL if index>=cmd_queue_count()
+ */
+const cmd_queue_entry_t* cmd_queue_entry(const uint32_t index);
+
+#endif
@@ -0,0 +1,37 @@
+// crc32.h
+// Tartan Artibeus EXPT board CRC-32 header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef CRC32_H
+#define CRC32_H
+
+// Standard library
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint32_t
+
+// Initialization functions
+
+/*  void init_crc32(void)
+ *    Enables the CRC unit and configures it for the CRC-32 used by zlib and
+ *    Python's binascii.crc32 (reflected polynomial 0x04c11db7, all-ones init,
+ *    all-ones final XOR)
+ */
+void init_crc32(void);
+
+// CRC functions
+
+/*  uint32_t crc32(const uint32_t crc, const uint8_t* data, const size_t len)
+ *    crc:  CRC-32 of the preceding bytes, or 0 to start a new computation
+ *    data: bytes to add to the CRC
+ *    len:  number of bytes
+ *  Return:
+ *    CRC-32 of the preceding bytes followed by data; calls can be chained, so
+ *    crc32(crc32(0,a,m),b,n) equals the CRC-32 of a followed by b
+ */
+uint32_t crc32(const uint32_t crc, const uint8_t* data, const size_t len);
+
+#endif
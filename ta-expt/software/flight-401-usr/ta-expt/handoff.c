@@ -0,0 +1,49 @@
+// handoff.c
+// Tartan Artibeus EXPT board handoff implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                 // size_t
+#include <stdint.h>                 // uint32_t
+
+// ta-expt library
+#include <handoff.h>                // Header file
+
+// Variables
+
+//// Handoff block in no-init SRAM2
+static handoff_t* const handoff = (handoff_t*)HANDOFF_ADDR;
+
+// Handoff functions
+
+handoff_t* handoff_begin(void) {
+  handoff->magic = 0;
+  handoff->version = 0;
+  handoff->flags = 0;
+  handoff->rx_len = 0;
+  return handoff;
+}
+
+void handoff_commit(void) {
+  if(handoff->rx_len>HANDOFF_RX_MAX) {
+    handoff->rx_len = HANDOFF_RX_MAX;
+  }
+  handoff->version = HANDOFF_VERSION;
+  handoff->magic = HANDOFF_MAGIC;
+}
+
+int handoff_take(handoff_t* handoff_o) {
+  if(
+   handoff->magic!=HANDOFF_MAGIC || handoff->version!=HANDOFF_VERSION ||
+   handoff->rx_len>HANDOFF_RX_MAX
+  ) {
+    return 0;
+  }
+  *handoff_o = *handoff;
+  handoff->magic = 0;
+  return 1;
+}
@@ -0,0 +1,209 @@
+// jobs.c
+// Tartan Artibeus EXPT board periodic job table implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                 // size_t, NULL
+#include <stdint.h>                 // uint8_t, uint32_t
+
+// libopencm3 library
+#include <libopencm3/stm32/flash.h> // used in jobs_configure
+
+// ta-expt library
+#include <crc32.h>                  // used to seal log records
+#include <jobs.h>                   // Header file
+#include <slots.h>                  // slot_mapped, slot_erase_page,
+                                    //  slot_program_log
+#include <trace.h>                  // TRACE2
+
+// Variables
+
+//// Defaults; the beacon and ephemeris jobs are kept off the LSI second
+static const job_config_t JOB_DEFAULTS[JOB_COUNT] = {
+ {
+  .period_s  = JOB_LSI_CAL_PERIOD_S,
+  .phase_s   = 0,
+  .budget_us = JOB_LSI_CAL_BUDGET_US,
+  .enabled   = 1
+ },
+ {
+  .period_s  = JOB_EPHEMERIS_PERIOD_S,
+  .phase_s   = JOB_EPHEMERIS_PHASE_S,
+  .budget_us = JOB_EPHEMERIS_BUDGET_US,
+  .enabled   = 1
+ },
+ {
+  .period_s  = JOB_BEACON_PERIOD_S,
+  .phase_s   = JOB_BEACON_PHASE_S,
+  .budget_us = JOB_BEACON_BUDGET_US,
+  .enabled   = 1
+ }
+};
+
+job_config_t job_configs[JOB_COUNT];
+job_stats_t job_stats[JOB_COUNT];
+uint32_t job_pending = 0;   // Bit id set while job id waits to run
+uint32_t job_sec = 0;       // Last second handled by jobs_tick
+int job_sec_valid = 0;      // Boolean; zero until the first jobs_tick
+uint32_t job_records = 0;   // Records in the job configuration log
+
+// Helper functions
+
+//// Address of the job configuration log in the current memory map
+static uint32_t jobs_log_addr(void) {
+  uint32_t bank1 = (slot_mapped()==SLOT_B) ? SLOT_BANK_SIZE : 0;
+  return SLOT_FLASH_BASE+bank1+JOB_LOG_OFFSET;
+}
+
+//// Seal over the first 60 bytes of a record
+static uint32_t jobs_seal(const job_record_t* record) {
+  return crc32(0, (const uint8_t*)record, sizeof(job_record_t)-4);
+}
+
+//// Programs the table as record index; flash must be unlocked
+static int jobs_program_record(const uint32_t index) {
+  job_record_t record = {
+   .magic     = JOB_RECORD_MAGIC,
+   .reserved  = 0xffffffff,
+   .reserved2 = 0xffffffff,
+   .seal      = 0
+  };
+  for(size_t i=0; i<JOB_COUNT; i++) {
+    record.config[i] = job_configs[i];
+  }
+  record.seal = jobs_seal(&record);
+  return slot_program_log(
+   jobs_log_addr()+index*sizeof(job_record_t), &record, sizeof(record)
+  );
+}
+
+//// Non-zero if config is one the scheduler can run
+static int jobs_config_valid(const job_config_t* config) {
+  return config->period_s>0 && config->phase_s<config->period_s;
+}
+
+// Job table functions
+
+void jobs_load(void) {
+  for(size_t i=0; i<JOB_COUNT; i++) {
+    job_configs[i] = JOB_DEFAULTS[i];
+    job_stats[i].runs = 0;
+    job_stats[i].overruns = 0;
+    job_stats[i].last_us = 0;
+    job_stats[i].max_us = 0;
+  }
+  job_pending = 0;
+  job_sec_valid = 0;
+  job_records = 0;
+  uint32_t capacity = JOB_LOG_SIZE/sizeof(job_record_t);
+  for(uint32_t i=0; i<capacity; i++) {
+    const job_record_t* record =
+     (const job_record_t*)(jobs_log_addr()+i*sizeof(job_record_t));
+    if(record->magic==0xffffffff && record->reserved==0xffffffff) {
+      break;                                  // End of log
+    }
+    job_records = i+1;                        // Torn records still use space
+    if(record->magic!=JOB_RECORD_MAGIC || record->seal!=jobs_seal(record)) {
+      continue;
+    }
+    int valid = 1;
+    for(size_t j=0; j<JOB_COUNT; j++) {
+      valid = valid && jobs_config_valid(&(record->config[j]));
+    }
+    if(valid) {
+      for(size_t j=0; j<JOB_COUNT; j++) {
+        job_configs[j] = record->config[j];
+      }
+    }
+  }
+}
+
+int jobs_configure(const uint8_t id, const job_config_t* config) {
+  if(id>=JOB_COUNT || !jobs_config_valid(config)) {
+    return 0;
+  }
+  job_config_t previous = job_configs[id];
+  job_configs[id] = *config;
+  job_pending &= ~(((uint32_t)1)<<id);
+  flash_unlock();
+  if(job_records>=JOB_LOG_SIZE/sizeof(job_record_t)) {
+    slot_erase_page(JOB_LOG_PAGE);
+    job_records = 0;
+  }
+  int success = jobs_program_record(job_records++);
+  flash_lock();
+  if(!success) {
+    job_configs[id] = previous;               // Keep RAM and log in step
+  }
+  return success;
+}
+
+const job_config_t* jobs_config(const uint8_t id) {
+  return (id<JOB_COUNT) ? &job_configs[id] : NULL;
+}
+
+const job_stats_t* jobs_stats(const uint8_t id) {
+  return (id<JOB_COUNT) ? &job_stats[id] : NULL;
+}
+
+uint32_t jobs_overruns(void) {
+  uint32_t overruns = 0;
+  for(size_t i=0; i<JOB_COUNT; i++) {
+    overruns += job_stats[i].overruns;
+  }
+  return overruns;
+}
+
+void jobs_tick(const uint32_t sec) {
+  if(!job_sec_valid || sec-job_sec>JOB_CATCH_UP_S) {
+    job_sec = sec-1;                          // Only this second is due
+    job_sec_valid = 1;
+  }
+  while(job_sec!=sec) {
+    job_sec += 1;
+    for(uint8_t id=0; id<JOB_COUNT; id++) {
+      if(
+       job_configs[id].enabled &&
+       job_sec%job_configs[id].period_s==job_configs[id].phase_s
+      ) {
+        if(job_pending&(((uint32_t)1)<<id)) { // Last run never happened
+          job_stats[id].overruns += 1;
+          TRACE2(TRACE_EVENT_JOB_OVERRUN, id, 0);
+        }
+        job_pending |= ((uint32_t)1)<<id;
+      }
+    }
+  }
+}
+
+uint8_t jobs_next(void) {
+  for(uint8_t id=0; id<JOB_COUNT; id++) {
+    if(job_pending&(((uint32_t)1)<<id)) {
+      job_pending &= ~(((uint32_t)1)<<id);
+      return id;
+    }
+  }
+  return JOB_NONE;
+}
+
+int jobs_pending(void) {
+  return job_pending!=0;
+}
+
+void jobs_done(const uint8_t id, const uint32_t us) {
+  if(id<JOB_COUNT) {
+    job_stats[id].runs += 1;
+    job_stats[id].last_us = us;
+    if(us>job_stats[id].max_us) {
+      job_stats[id].max_us = us;
+    }
+    if(us>job_configs[id].budget_us) {
+      job_stats[id].overruns += 1;
+      TRACE2(TRACE_EVENT_JOB_OVERRUN, id, us);
+    }
+  }
+}
@@ -0,0 +1,136 @@
+// jobs.h
+// Tartan Artibeus EXPT board periodic job table header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef JOBS_H
+#define JOBS_H
+
+// Standard library
+#include <stdint.h> // uint8_t, uint32_t
+
+// Macros
+
+//// Job IDs; run_jobs holds what each one does
+#define JOB_LSI_CAL   ((uint8_t)0) // Starts an LSI calibration
+#define JOB_EPHEMERIS ((uint8_t)1) // Propagates the uplinked TLE to now
+#define JOB_BEACON    ((uint8_t)2) // Traces a housekeeping record
+#define JOB_COUNT     ((uint8_t)3)
+#define JOB_NONE      ((uint8_t)0xff)
+
+//// Default configuration, used until APP_SET_JOB changes it
+#define JOB_LSI_CAL_PERIOD_S    ((uint32_t)600)
+#define JOB_LSI_CAL_BUDGET_US   ((uint32_t)200)
+#define JOB_EPHEMERIS_PERIOD_S  ((uint32_t)60)
+#define JOB_EPHEMERIS_PHASE_S   ((uint32_t)30)
+#define JOB_EPHEMERIS_BUDGET_US ((uint32_t)5000)
+#define JOB_BEACON_PERIOD_S     ((uint32_t)10)
+#define JOB_BEACON_PHASE_S      ((uint32_t)5)
+#define JOB_BEACON_BUDGET_US    ((uint32_t)200)
+
+//// A jump in the tick count larger than this (the RTC was set or stepped)
+//// restarts the schedule instead of catching up on the seconds in between
+#define JOB_CATCH_UP_S ((uint32_t)5)
+
+//// Job configuration log; page 34 of bank 1, just past the queue log. Each
+//// record holds the whole table and the last valid one wins, so a full page
+//// is simply erased
+#define JOB_LOG_PAGE      ((uint32_t)34)
+#define JOB_LOG_OFFSET    ((uint32_t)0x00011000U) // From start of bank 1
+#define JOB_LOG_SIZE      ((uint32_t)2048)
+#define JOB_RECORD_MAGIC  ((uint32_t)0x53424f4aU) // "JOBS", LSB first
+
+// Typedefs
+
+//// Job configuration; the job is due whenever the tick count modulo period_s
+//// equals phase_s. With the RTC set, the tick count is rtc_sec, so phases
+//// line up with J2000 seconds
+typedef struct job_config {
+  uint32_t period_s;  // Seconds between runs; non-zero
+  uint32_t phase_s;   // Offset within the period; below period_s
+  uint32_t budget_us; // Run time above this counts as an overrun
+  uint32_t enabled;   // Boolean
+} job_config_t;
+
+//// Job accounting since boot
+typedef struct job_stats {
+  uint32_t runs;     // Completed runs
+  uint32_t overruns; // Runs over budget, plus runs missed while pending
+  uint32_t last_us;  // Run time of the last run
+  uint32_t max_us;   // Longest run time
+} job_stats_t;
+
+//// Job configuration log record; 8 double words, written by slot_program_log
+typedef struct job_record {
+  uint32_t     magic;             // JOB_RECORD_MAGIC
+  uint32_t     reserved;          // 0xffffffff
+  job_config_t config[JOB_COUNT]; // The whole table
+  uint32_t     reserved2;         // 0xffffffff
+  uint32_t     seal;              // crc32 of the preceding 60 bytes
+} job_record_t;
+
+// Job table functions
+
+/*  void jobs_load(void)
+ *    Loads the default configuration, then the last valid record in the job
+ *    configuration log, if any
+ */
+void jobs_load(void);
+
+/*  int jobs_configure(const uint8_t id, const job_config_t* config)
+ *    id:     job to change
+ *    config: new configuration; written to the job configuration log
+ *  Return:
+ *    0 to indicate failure (unknown job, zero period, phase too large or the
+ *    record could not be written); the old configuration is kept
+ *    Non-zero to indicate success
+ */
+int jobs_configure(const uint8_t id, const job_config_t* config);
+
+/*  const job_config_t* jobs_config(const uint8_t id)
+ *  Return:
+ *    Configuration of job id, or NULL if id>=JOB_COUNT
+ */
+const job_config_t* jobs_config(const uint8_t id);
+
+/*  const job_stats_t* jobs_stats(const uint8_t id)
+ *  Return:
+ *    Accounting of job id, or NULL if id>=JOB_COUNT
+ */
+const job_stats_t* jobs_stats(const uint8_t id);
+
+/*  uint32_t jobs_overruns(void)
+ *  Return:
+ *    Overruns of all jobs
+ */
+uint32_t jobs_overruns(void);
+
+/*  void jobs_tick(const uint32_t sec)
+ *    sec: current tick count; marks the jobs due in each second since the
+ *         last call as pending. A job due again while still pending is an
+ *         overrun
+ */
+void jobs_tick(const uint32_t sec);
+
+/*  uint8_t jobs_next(void)
+ *  Return:
+ *    The lowest pending job ID, no longer pending, or JOB_NONE
+ */
+uint8_t jobs_next(void);
+
+/*  int jobs_pending(void)
+ *  Return:
+ *    Non-zero if any job is waiting to run
+ */
+int jobs_pending(void);
+
+/*  void jobs_done(const uint8_t id, const uint32_t us)
+ *    id: job that ran
+ *    us: its run time in microseconds, checked against its budget
+ */
+void jobs_done(const uint8_t id, const uint32_t us);
+
+#endif
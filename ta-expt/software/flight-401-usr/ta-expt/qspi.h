@@ -0,0 +1,43 @@
+// qspi.h
+// Tartan Artibeus EXPT board QSPI flash execute-in-place header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef QSPI_H
+#define QSPI_H
+
+// Standard library
+#include <stdint.h> // uint32_t
+
+// Macros
+
+//// Memory-mapped QSPI flash; 16 MB behind QUADSPI flash 2 (BK2_NCS on PC11)
+#define QSPI_XIP_ADDR   ((uint32_t)0x90000000U)
+#define QSPI_FLASH_SIZE ((uint32_t)0x01000000U)
+
+//// Read command used in memory-mapped mode: fast read quad output (1-1-4),
+//// one-line instruction and 24-bit address, then 8 dummy cycles
+#define QSPI_CMD_READ_QUAD_OUT ((uint32_t)0x6b)
+#define QSPI_READ_DUMMY_CYCLES ((uint32_t)8)
+
+// Initialization functions
+
+/*  void init_qspi(void)
+ *    Sets up the QUADSPI pins (IO0-IO3 on PC1-PC4, CLK on PA3, BK2_NCS on
+ *    PC11) and the QUADSPI for flash 2; the GPIO ports are not reset, since
+ *    USART1 and the LEDs share them
+ */
+void init_qspi(void);
+
+// QSPI functions
+
+/*  void qspi_memory_mapped(void)
+ *    Maps the QSPI flash read-only at QSPI_XIP_ADDR; QUADSPI registers other
+ *    than the abort bit are locked until the next reset of the peripheral
+ */
+void qspi_memory_mapped(void);
+
+#endif
@@ -15,12 +15,44 @@
 #include <libopencm3/stm32/flash.h> // flash erase and write
 
 // ta-expt library
+#include <boot_record.h>            // Reported in APP_TELEM
+#include <cmd_queue.h>              // Time-tagged command queue
 #include <application.h>            // Application macros
+#include <crc32.h>                  // used in bootloader_subpage_crc
+#include <jobs.h>                   // Periodic job table
+#include <qspi.h>                   // used in bootloader_verify_xip
+#include <slots.h>                  // A/B application slots
 #include <taolst_protocol.h>        // Header file
+#include <timebase.h>               // used in bl_flash_program
+#include <upload_session.h>         // Resumable upload session
 
 // Variables
 extern int in_bootloader;    // Used in bootloader main to indicate MCU state
 extern int app_jump_pending; // Used in bootloader main to signal jump to app
+extern uint32_t uart_baud_pending; // Used in baud_usart1 to switch baud rate
+extern sleep_stats_t sleep_stats;  // Reported in APP_TELEM
+extern int32_t lsi_ppm;            // Reported in APP_TELEM
+extern eci_posn_t ephemeris;       // Reported in APP_TELEM
+extern uint32_t ephemeris_sec;     // Reported in APP_TELEM
+uint32_t app_erased_pages = 0;     // Pages erased by last BOOTLOADER_ERASE
+uint64_t page_buff[BYTES_PER_PAGE/8]; // Staged page; double-word aligned
+uint32_t staged_page = STAGED_PAGE_NONE; // Page held in page_buff
+uint32_t staged_subpages = 0;      // Bit i set if subpage i of it is held
+image_digest_t image_digest = {.crc=0, .crc_prev=0, .subpages=0};
+lz_state_t lz_state = {
+ .in_offset = 0,
+ .out_len   = 0,
+ .distance  = 0,
+ .old_len   = 0,
+ .old_pos   = 0,
+ .arg       = 0,
+ .state     = LZ_STATE_CONTROL,
+ .count     = 0,
+ .op        = PATCH_OP_COPY
+};
+slot_t upload_slot = SLOT_NONE;    // See bl_upload_slot
+uint32_t program_cycles_page = 0;    // Last whole-page bl_flash_program
+uint32_t program_cycles_subpage = 0; // Last partial-page bl_flash_program
 tle_t tle = {
  .epoch_year     = 0,
  .epoch_day      = 0.0f,
@@ -32,6 +64,7 @@ tle_t tle = {
  .mean_anomaly   = 0.0f,
  .mean_motion    = 0.0f
 };
+sgp4_state_t sgp4_state;           // Set by sgp4_init with tle
 date_time_t tle_epoch = {
  .year       = 0,
  .month      = 0,
@@ -84,58 +117,632 @@ int bootloader_running(void) {
   return in_bootloader;
 }
 
-// Command functions
+//// Writes val into data[0] through data[3], LSB first
+void pack_uint32(uint8_t* data, const uint32_t val) {
+  data[0] = (uint8_t)((val >>  0) & 0xff); // LSB
+  data[1] = (uint8_t)((val >>  8) & 0xff);
+  data[2] = (uint8_t)((val >> 16) & 0xff);
+  data[3] = (uint8_t)((val >> 24) & 0xff); // MSB
+}
 
-//// BOOTLOADER_ERASE
-int bootloader_erase(void) {
-  flash_unlock();
-  for(size_t subpage_id=0; subpage_id<255; subpage_id++) {
-    // subpage_id==0x00 writes to APP_ADDR==0x08008000 i.e. start of page 16
-    // So subpage_id==0x10 writes to addr 0x08008800 i.e. start of page 17 etc
-    // Need to erase page once before writing inside of it
-    if((subpage_id*BYTES_PER_CMD)%BYTES_PER_PAGE==0) {
-      flash_erase_page(16+(subpage_id*BYTES_PER_CMD)/BYTES_PER_PAGE);
+//// Reads a uint32_t from data[0] through data[3], LSB first
+uint32_t unpack_uint32(const uint8_t* data) {
+  return
+   ((uint32_t)(data[3])<<24) | ((uint32_t)(data[2])<<16) |
+   ((uint32_t)(data[1])<< 8) | ((uint32_t)(data[0])<< 0);
+}
+
+//// Non-zero if len bytes of flash at addr equal src; blank_o is set non-zero
+//// if the flash bytes are all erased
+static int bl_flash_matches(
+ const uint32_t addr, const uint8_t* src, const size_t len, int* blank_o
+) {
+  int same = 1;
+  *blank_o = 1;
+  for(size_t i=0; i<len; i++) {
+    uint8_t b = MMIO8(addr+i);
+    *blank_o = *blank_o && (b==((uint8_t)0xff));
+    same = same && (b==src[i]);
+  }
+  return same;
+}
+
+//// Programs len bytes (a multiple of 8) from src into erased flash at addr;
+//// double words that are still all ones are left erased. Flash is unlocked.
+//// Returns 0 as soon as FLASH_SR reports a programming error, else non-zero.
+//// The time taken is kept for APP_TELEM
+static int bl_flash_program(
+ const uint32_t addr, const uint8_t* src, const size_t len
+) {
+  uint64_t start = now_cycles();
+  int success = 1;
+  flash_wait_for_last_operation();
+  flash_clear_status_flags();           // A stale error would block PG
+  for(size_t i=0; i<len && success; i+=8) {
+    uint32_t lo = unpack_uint32(src+i);
+    uint32_t hi = unpack_uint32(src+i+4);
+    if(lo!=0xffffffff || hi!=0xffffffff) {
+      FLASH_CR |= FLASH_CR_PG;
+      MMIO32(i+addr)   = lo;
+      MMIO32(i+addr+4) = hi;
+      flash_wait_for_last_operation();
+      FLASH_CR &= ~FLASH_CR_PG;
+      success = (FLASH_SR & FLASH_SR_PROGRAM_ERRORS)==0;
       flash_clear_status_flags();
     }
   }
-  flash_lock();
+  if(len==BYTES_PER_PAGE) {
+    program_cycles_page = (uint32_t)(now_cycles()-start);
+  } else {
+    program_cycles_subpage = (uint32_t)(now_cycles()-start);
+  }
+  return success;
+}
+
+//// Slot that uploads go to: the slot that is not running in the application,
+//// or not confirmed in the bootloader. Without dual-bank flash it is the one
+//// slot at APP_ADDR. Only a SLOT_RECORD_CONFIRM changes it, and that is only
+//// written at application start, so it is looked up once
+static slot_t bl_upload_slot(void) {
+  if(upload_slot==SLOT_NONE) {
+    if(!slots_enabled()) {
+      upload_slot = SLOT_A;
+    } else if(bootloader_running()) {
+      slot_state_t state = slot_read_state();
+      upload_slot = slot_other(state.active);
+    } else {
+      upload_slot = slot_other(slot_mapped());
+    }
+  }
+  return upload_slot;
+}
+
+//// Uploads are always allowed in the bootloader; the application may only
+//// write the other bank, so it needs dual-bank flash
+static int bl_upload_allowed(void) {
+  return bootloader_running() || slots_enabled();
+}
+
+//// Restarts the running image digest
+static void bl_digest_reset(void) {
+  image_digest.crc = 0;
+  image_digest.crc_prev = 0;
+  image_digest.subpages = 0;
+}
+
+//// Extends the running image digest after subpage_id was written; changed = 0
+//// if flash already held the same data. Also records the subpage in the
+//// upload session of the upload slot
+static void bl_digest_written(const uint32_t subpage_id, const int changed) {
+  upload_session_t session;
+  if(upload_session_read(&session) && session.slot==bl_upload_slot()) {
+    upload_session_mark(subpage_id);
+  }
+  if(subpage_id==image_digest.subpages) {
+    image_digest.crc_prev = image_digest.crc;
+    image_digest.crc = crc32(
+     image_digest.crc,
+     (const uint8_t*)(slot_addr(bl_upload_slot())+subpage_id*BYTES_PER_CMD),
+     BYTES_PER_CMD
+    );
+    image_digest.subpages += 1;
+  } else if(subpage_id<image_digest.subpages && changed) {
+    bl_digest_reset();                  // Covered data changed; start over
+  }                                     // Out of order: caught up at JUMP
+}
+
+//// Restarts the BOOTLOADER_WRITE_LZ stream at offset 0 of the image
+static void bl_lz_reset(void) {
+  lz_state.in_offset = 0;
+  lz_state.out_len = 0;
+  lz_state.distance = 0;
+  lz_state.old_len = 0;
+  lz_state.old_pos = 0;
+  lz_state.arg = 0;
+  lz_state.state = LZ_STATE_CONTROL;
+  lz_state.count = 0;
+  lz_state.op = PATCH_OP_COPY;
+}
+
+//// Image byte at pos for an LZ match; the page being assembled is in
+//// page_buff and earlier pages have been programmed
+static uint8_t bl_lz_get(const uint32_t pos) {
+  if(pos/BYTES_PER_PAGE==staged_page) {
+    return ((uint8_t*)page_buff)[pos%BYTES_PER_PAGE];
+  } else {
+    return MMIO8(slot_addr(bl_upload_slot())+pos);
+  }
+}
+
+//// Appends one decompressed byte to the image through the page buffer, which
+//// is programmed as each page fills; 0 if past the erased pages or if
+//// programming failed
+static int bl_lz_put(const uint8_t b) {
+  uint32_t pos = lz_state.out_len;
+  uint32_t page = pos/BYTES_PER_PAGE;
+  uint8_t* buff = (uint8_t*)page_buff;
+  if(page>=app_erased_pages) {
+    return 0;
+  }
+  if(page!=staged_page) {
+    if(!bootloader_flush()) {
+      return 0;
+    }
+    for(size_t i=0; i<BYTES_PER_PAGE; i++) {
+      buff[i] = ((uint8_t)0xff);
+    }
+    staged_page = page;
+  }
+  buff[pos%BYTES_PER_PAGE] = b;
+  staged_subpages |= ((uint32_t)1)<<((pos%BYTES_PER_PAGE)/BYTES_PER_CMD);
+  lz_state.out_len += 1;
+  if((lz_state.out_len%BYTES_PER_PAGE)==0) {
+    return bootloader_flush();
+  }
+  return 1;
+}
+
+//// Old image byte at pos for BOOTLOADER_PATCH; 0 if past the old image
+static int bl_patch_get(const uint32_t pos, uint8_t* b_o) {
+  if(pos>=lz_state.old_len) {
+    return 0;
+  }
+  *b_o = MMIO8(slot_addr(slot_other(bl_upload_slot()))+pos);
   return 1;
 }
 
-//// Given a well-formed BOOTLOADER_WRITE_PAGE command, write data to flash
+//// Feeds one BOOTLOADER_PATCH stream byte to the decoder; 0 if the stream is
+//// corrupt, does not fit the old image, or runs past the erased pages
+static int bl_patch_byte(const uint8_t b) {
+  int success = 1;
+  uint8_t old = 0;
+  switch(lz_state.state) {
+    case LZ_STATE_PATCH_HEADER:
+      if(lz_state.count<4) {
+        lz_state.old_len |= ((uint32_t)b)<<(8*lz_state.count);
+      } else {
+        lz_state.arg |= ((uint32_t)b)<<(8*(lz_state.count-4));
+      }
+      lz_state.count += 1;
+      if(lz_state.count==PATCH_HEADER_LEN) {
+        // The patch only applies to the old image it was made against
+        success =
+         lz_state.old_len<=APP_MAX_PAGES*BYTES_PER_PAGE &&
+         crc32(
+          0, (const uint8_t*)slot_addr(slot_other(bl_upload_slot())),
+          lz_state.old_len
+         )==lz_state.arg;
+        lz_state.state = LZ_STATE_PATCH_OP;
+      }
+      break;
+    case LZ_STATE_PATCH_OP:
+      success = (b<=PATCH_OP_SEEK);
+      lz_state.op = b;
+      lz_state.arg = 0;
+      lz_state.count = 0;
+      lz_state.state = LZ_STATE_PATCH_ARG;
+      break;
+    case LZ_STATE_PATCH_ARG:
+      lz_state.arg |= ((uint32_t)(b&0x7f))<<(7*lz_state.count);
+      lz_state.count += 1;
+      if(b&0x80) {
+        success = (lz_state.count<PATCH_ARG_BYTES_MAX);
+      } else if(lz_state.op==PATCH_OP_COPY) {
+        for(uint32_t n=0; n<lz_state.arg && success; n++) {
+          success =
+           bl_patch_get(lz_state.old_pos, &old) && bl_lz_put(old);
+          lz_state.old_pos += 1;
+        }
+        lz_state.state = LZ_STATE_PATCH_OP;
+      } else if(lz_state.op==PATCH_OP_SEEK) {
+        // zigzag: 0, -1, 1, -2, ... are sent as 0, 1, 2, 3, ...
+        uint32_t step = lz_state.arg>>1;
+        if(lz_state.arg&1) {
+          success = (step+1<=lz_state.old_pos);
+          lz_state.old_pos -= success ? step+1 : 0;
+        } else {
+          success = (step<=lz_state.old_len-lz_state.old_pos);
+          lz_state.old_pos += success ? step : 0;
+        }
+        lz_state.state = LZ_STATE_PATCH_OP;
+      } else if(lz_state.arg>0) {
+        lz_state.state = LZ_STATE_PATCH_DATA;
+      } else {
+        lz_state.state = LZ_STATE_PATCH_OP;
+      }
+      break;
+    case LZ_STATE_PATCH_DATA:
+      if(lz_state.op==PATCH_OP_ADD) {
+        success =
+         bl_patch_get(lz_state.old_pos, &old) && bl_lz_put((uint8_t)(old+b));
+        lz_state.old_pos += 1;
+      } else {
+        success = bl_lz_put(b);
+      }
+      lz_state.arg -= 1;
+      if(lz_state.arg==0) {
+        lz_state.state = LZ_STATE_PATCH_OP;
+      }
+      break;
+    default:
+      success = 0;
+      break;
+  }
+  return success;
+}
+
+// Command functions
+
+//// BOOTLOADER_ERASE; erases the pages covered by an image of image_len bytes
+//// and starts an upload session for it. Returns the number of pages erased,
+//// or 0 if image_len is invalid
+uint32_t bootloader_erase(
+ const uint32_t image_len, const uint32_t image_id, const uint32_t image_crc
+) {
+  uint32_t pages = (image_len+BYTES_PER_PAGE-1)/BYTES_PER_PAGE;
+  if(pages==0 || pages>APP_MAX_PAGES) {
+    return 0;
+  }
+  app_erased_pages = 0;
+  staged_page = STAGED_PAGE_NONE;       // Staged data would go to erased pages
+  staged_subpages = 0;
+  bl_digest_reset();
+  bl_lz_reset();
+  flash_unlock();
+  for(uint32_t page=0; page<pages; page++) {
+    slot_erase_page(slot_first_page(bl_upload_slot())+page);
+    flash_clear_status_flags();
+  }
+  flash_lock();
+  upload_session_t session = {
+   .image_id  = image_id,
+   .image_len = image_len,
+   .image_crc = image_crc,
+   .slot      = (uint8_t)bl_upload_slot(),
+   .pages     = (uint8_t)pages
+  };
+  upload_session_start(&session);
+  app_erased_pages = pages;
+  return pages;
+}
+
+//// BOOTLOADER_ERASE with an image ID; if the stored upload session is for the
+//// same image and slot, picks it up without erasing. Returns the number of
+//// pages erased by that session, or 0 if there is no matching session
+uint32_t bootloader_resume(
+ const uint32_t image_len, const uint32_t image_id, const uint32_t image_crc
+) {
+  upload_session_t session;
+  if(
+   !upload_session_read(&session) || session.image_id!=image_id ||
+   session.image_len!=image_len || session.image_crc!=image_crc ||
+   session.slot!=(uint8_t)bl_upload_slot() ||
+   session.pages==0 || session.pages>APP_MAX_PAGES
+  ) {
+    return 0;
+  }
+  staged_page = STAGED_PAGE_NONE;
+  staged_subpages = 0;
+  bl_digest_reset();                    // Caught up at JUMP
+  bl_lz_reset();                        // An LZ stream cannot be resumed
+  app_erased_pages = session.pages;
+  return app_erased_pages;
+}
+
+//// BOOTLOADER_GET_GAPS; writes the first and last subpage ID of up to max
+//// ranges of the upload session not yet in flash, starting at subpage first.
+//// Returns the number of ranges written
+uint32_t bootloader_gaps(
+ const uint32_t first, uint8_t* ranges_o, const uint32_t max
+) {
+  upload_session_t session;
+  if(!upload_session_read(&session)) {
+    return 0;
+  }
+  uint32_t subpages = (session.image_len+BYTES_PER_CMD-1)/BYTES_PER_CMD;
+  uint32_t ranges = 0;
+  uint32_t id = first;
+  while(id<subpages && ranges<max) {
+    if(upload_session_received(id)) {
+      id++;
+    } else {
+      ranges_o[2*ranges] = (uint8_t)id;
+      while(id+1<subpages && !upload_session_received(id+1)) {
+        id++;
+      }
+      ranges_o[2*ranges+1] = (uint8_t)id;
+      ranges++;
+      id++;
+    }
+  }
+  return ranges;
+}
+
+//// Given a well-formed BOOTLOADER_WRITE_PAGE command, stage data in the page
+//// buffer; the page is programmed once all of its subpages are staged or on
+//// bootloader_flush. The target page must have been erased by
+//// BOOTLOADER_ERASE
 int bootloader_write_data(rx_cmd_buff_t* rx_cmd_buff) {
   if(
    rx_cmd_buff->state==RX_CMD_BUFF_STATE_COMPLETE &&
    rx_cmd_buff->data[OPCODE_INDEX]==BOOTLOADER_WRITE_PAGE_OPCODE
   ) {
-    flash_unlock();
     uint32_t subpage_id = (uint32_t)(rx_cmd_buff->data[DATA_START_INDEX]);
-    // subpage_id==0x00 writes to APP_ADDR==0x08008000 i.e. start of page 16
-    // So subpage_id==0x10 writes to addr 0x08008800 i.e. start of page 17 etc
-    // Need to erase page once before writing inside of it
-    if((subpage_id*BYTES_PER_CMD)%BYTES_PER_PAGE==0) {
-      flash_erase_page(16+(subpage_id*BYTES_PER_CMD)/BYTES_PER_PAGE);
-      flash_clear_status_flags();
+    // subpage_id==0x00 writes to the start of page 16 of the upload slot
+    // So subpage_id==0x10 writes to the start of page 17 etc
+    // The page must lie within the range erased by the last BOOTLOADER_ERASE
+    uint32_t page = subpage_id/SUBPAGES_PER_PAGE;
+    uint32_t bit = ((uint32_t)1)<<(subpage_id%SUBPAGES_PER_PAGE);
+    if(page>=app_erased_pages) {
+      return 0;
     }
-    // write data
-    uint32_t start_addr = APP_ADDR+subpage_id*BYTES_PER_CMD;
-    for(size_t i=0; i<BYTES_PER_CMD; i+=8) {
-      uint64_t dword = *(uint64_t*)((rx_cmd_buff->data)+DATA_START_INDEX+1+i);
-      flash_wait_for_last_operation();
-      FLASH_CR |= FLASH_CR_PG;
-      MMIO32(i+start_addr)   = (uint32_t)(dword);
-      MMIO32(i+start_addr+4) = (uint32_t)(dword >> 32);
-      flash_wait_for_last_operation();
-      FLASH_CR &= ~FLASH_CR_PG;
-      flash_clear_status_flags();
+    // A retransmitted subpage is already staged or in flash; otherwise the
+    // flash must be blank
+    uint32_t start_addr = slot_addr(bl_upload_slot())+subpage_id*BYTES_PER_CMD;
+    const uint8_t* src = (rx_cmd_buff->data)+DATA_START_INDEX+1;
+    int blank = 0;
+    if(!(page==staged_page && (staged_subpages&bit))) {
+      if(bl_flash_matches(start_addr, src, BYTES_PER_CMD, &blank)) {
+        bl_digest_written(subpage_id, 0);
+        return 1;
+      } else if(!blank) {
+        return 0;
+      }
+    }
+    // stage data; a subpage of another page programs the staged one first
+    uint8_t* buff = (uint8_t*)page_buff;
+    if(page!=staged_page) {
+      if(!bootloader_flush()) {
+        return 0;
+      }
+      for(size_t i=0; i<BYTES_PER_PAGE; i++) {
+        buff[i] = ((uint8_t)0xff);
+      }
+      staged_page = page;
+    }
+    uint32_t offset = (subpage_id%SUBPAGES_PER_PAGE)*BYTES_PER_CMD;
+    for(size_t i=0; i<BYTES_PER_CMD; i++) {
+      buff[offset+i] = src[i];
+    }
+    staged_subpages |= bit;
+    if(staged_subpages==((((uint32_t)1)<<SUBPAGES_PER_PAGE)-1)) {
+      return bootloader_flush();
     }
-    flash_lock();
     return 1;
   } else {
     return 0;
   }
 }
 
+//// BOOTLOADER_FLUSH; programs the staged page, if any, in one pass. Subpages
+//// that were not staged are all ones in page_buff, so they are left as is.
+//// Returns 0 if programming failed; the staged subpages are then dropped
+//// without being recorded as written, so they show up as gaps
+int bootloader_flush(void) {
+  if(staged_page==STAGED_PAGE_NONE) {
+    return 1;
+  }
+  uint32_t page_addr = slot_addr(bl_upload_slot())+staged_page*BYTES_PER_PAGE;
+  flash_unlock();
+  int success =
+   bl_flash_program(page_addr, (const uint8_t*)page_buff, BYTES_PER_PAGE);
+  flash_lock();
+  for(uint32_t i=0; i<SUBPAGES_PER_PAGE && success; i++) {
+    if(staged_subpages&(((uint32_t)1)<<i)) {
+      bl_digest_written(staged_page*SUBPAGES_PER_PAGE+i, 1);
+    }
+  }
+  staged_page = STAGED_PAGE_NONE;
+  staged_subpages = 0;
+  return success;
+}
+
+//// Given a well-formed BOOTLOADER_WRITE_LZ command, decompress the part of its
+//// data not yet consumed into the page buffer; a chunk past the expected
+//// offset is ignored. Returns 0 if the stream is corrupt or runs past the
+//// erased pages, else non-zero; lz_state.in_offset is the next offset
+int bootloader_write_lz(rx_cmd_buff_t* rx_cmd_buff) {
+  if(
+   rx_cmd_buff->state==RX_CMD_BUFF_STATE_COMPLETE &&
+   rx_cmd_buff->data[OPCODE_INDEX]==BOOTLOADER_WRITE_LZ_OPCODE &&
+   rx_cmd_buff->data[MSG_LEN_INDEX]>((uint8_t)0x0a) &&
+   lz_state.state!=LZ_STATE_FAILED
+  ) {
+    // stream offset of the chunk, LSB first, then the chunk
+    uint32_t offset = unpack_uint32((rx_cmd_buff->data)+DATA_START_INDEX);
+    uint32_t len = (uint32_t)(rx_cmd_buff->data[MSG_LEN_INDEX])-0x0a;
+    const uint8_t* src = (rx_cmd_buff->data)+DATA_START_INDEX+4;
+    if(offset>lz_state.in_offset || offset+len<=lz_state.in_offset) {
+      return 1;                         // Ahead, or already consumed
+    }
+    int success = 1;
+    for(uint32_t i=lz_state.in_offset-offset; i<len && success; i++) {
+      uint8_t b = src[i];
+      switch(lz_state.state) {
+        case LZ_STATE_CONTROL:
+          if(b<((uint8_t)0x80)) {
+            lz_state.count = b+1;
+            lz_state.state = LZ_STATE_LITERAL;
+          } else {
+            lz_state.count = (uint8_t)((b&0x7f)+LZ_MATCH_MIN);
+            lz_state.state = LZ_STATE_DIST_LSB;
+          }
+          break;
+        case LZ_STATE_LITERAL:
+          success = bl_lz_put(b);
+          lz_state.count -= 1;
+          if(lz_state.count==0) {
+            lz_state.state = LZ_STATE_CONTROL;
+          }
+          break;
+        case LZ_STATE_DIST_LSB:
+          lz_state.distance = (uint32_t)b;
+          lz_state.state = LZ_STATE_DIST_MSB;
+          break;
+        case LZ_STATE_DIST_MSB:
+          lz_state.distance |= ((uint32_t)b)<<8;
+          success =
+           lz_state.distance>0 && lz_state.distance<=lz_state.out_len;
+          for(uint32_t n=0; n<lz_state.count && success; n++) {
+            success = bl_lz_put(bl_lz_get(lz_state.out_len-lz_state.distance));
+          }
+          lz_state.state = LZ_STATE_CONTROL;
+          break;
+        default:
+          success = 0;
+          break;
+      }
+      lz_state.in_offset += 1;
+    }
+    if(!success) {
+      lz_state.state = LZ_STATE_FAILED; // Until the next BOOTLOADER_ERASE
+    }
+    return success;
+  } else {
+    return 0;
+  }
+}
+
+//// Given a well-formed BOOTLOADER_PATCH command, apply the part of its data
+//// not yet consumed, reading the old image from the other slot; framed like
+//// BOOTLOADER_WRITE_LZ. Returns 0 if the old image does not match the header,
+//// the patch is corrupt, or there is no other slot, else non-zero
+int bootloader_patch(rx_cmd_buff_t* rx_cmd_buff) {
+  if(
+   rx_cmd_buff->state==RX_CMD_BUFF_STATE_COMPLETE &&
+   rx_cmd_buff->data[OPCODE_INDEX]==BOOTLOADER_PATCH_OPCODE &&
+   rx_cmd_buff->data[MSG_LEN_INDEX]>((uint8_t)0x0a) &&
+   slots_enabled() &&                   // Old image must survive the erase
+   lz_state.state!=LZ_STATE_FAILED
+  ) {
+    // stream offset of the chunk, LSB first, then the chunk
+    uint32_t offset = unpack_uint32((rx_cmd_buff->data)+DATA_START_INDEX);
+    uint32_t len = (uint32_t)(rx_cmd_buff->data[MSG_LEN_INDEX])-0x0a;
+    const uint8_t* src = (rx_cmd_buff->data)+DATA_START_INDEX+4;
+    if(offset>lz_state.in_offset || offset+len<=lz_state.in_offset) {
+      return 1;                         // Ahead, or already consumed
+    }
+    if(lz_state.in_offset==0 && lz_state.state==LZ_STATE_CONTROL) {
+      lz_state.state = LZ_STATE_PATCH_HEADER; // First chunk since the erase
+    }
+    int success = 1;
+    for(uint32_t i=lz_state.in_offset-offset; i<len && success; i++) {
+      success = bl_patch_byte(src[i]);
+      lz_state.in_offset += 1;
+    }
+    if(!success) {
+      lz_state.state = LZ_STATE_FAILED; // Until the next BOOTLOADER_ERASE
+    }
+    return success;
+  } else {
+    return 0;
+  }
+}
+
+//// Given a well-formed BOOTLOADER_UPDATE command, bring one subpage of flash
+//// up to date without a prior BOOTLOADER_ERASE; only a page whose programmed
+//// content differs is erased. Returns a BOOTLOADER_UPDATE result or 0
+int bootloader_update_data(rx_cmd_buff_t* rx_cmd_buff) {
+  if(
+   rx_cmd_buff->state==RX_CMD_BUFF_STATE_COMPLETE &&
+   rx_cmd_buff->data[OPCODE_INDEX]==BOOTLOADER_UPDATE_OPCODE &&
+   rx_cmd_buff->data[MSG_LEN_INDEX]==((uint8_t)(0x07+BYTES_PER_CMD))
+  ) {
+    if(!bootloader_flush()) {           // Frees page_buff; flash is current
+      return 0;
+    }
+    uint32_t subpage_id = (uint32_t)(rx_cmd_buff->data[DATA_START_INDEX]);
+    uint32_t start_addr = slot_addr(bl_upload_slot())+subpage_id*BYTES_PER_CMD;
+    const uint8_t* src = (rx_cmd_buff->data)+DATA_START_INDEX+1;
+    int blank = 0;
+    if(bl_flash_matches(start_addr, src, BYTES_PER_CMD, &blank)) {
+      bl_digest_written(subpage_id, 0);
+      return BOOTLOADER_UPDATE_SKIPPED;
+    } else if(blank) {
+      flash_unlock();
+      int success = bl_flash_program(start_addr, src, BYTES_PER_CMD);
+      flash_lock();
+      if(!success) {
+        return 0;
+      }
+      bl_digest_written(subpage_id, 1);
+      return BOOTLOADER_UPDATE_WRITTEN;
+    }
+    // Programmed content differs: copy the page, patch it, erase and reprogram
+    uint32_t page = (subpage_id*BYTES_PER_CMD)/BYTES_PER_PAGE;
+    uint32_t page_addr = slot_addr(bl_upload_slot())+page*BYTES_PER_PAGE;
+    uint32_t offset = start_addr-page_addr;
+    uint8_t* buff = (uint8_t*)page_buff;
+    for(size_t i=0; i<BYTES_PER_PAGE; i++) {
+      buff[i] = MMIO8(page_addr+i);
+    }
+    for(size_t i=0; i<BYTES_PER_CMD; i++) {
+      buff[offset+i] = src[i];
+    }
+    flash_unlock();
+    slot_erase_page(slot_first_page(bl_upload_slot())+page);
+    flash_clear_status_flags();
+    int success = bl_flash_program(page_addr, buff, BYTES_PER_PAGE);
+    flash_lock();
+    if(!success) {
+      return 0;
+    }
+    bl_digest_written(subpage_id, 1);
+    return BOOTLOADER_UPDATE_REWRITTEN;
+  } else {
+    return 0;
+  }
+}
+
+//// CRC-32 (as computed by crc32) of the flash content of one subpage; the
+//// staged page is programmed first
+uint32_t bootloader_subpage_crc(const uint32_t subpage_id) {
+  bootloader_flush();
+  return crc32(
+   0, (const uint8_t*)(slot_addr(bl_upload_slot())+subpage_id*BYTES_PER_CMD),
+   BYTES_PER_CMD
+  );
+}
+
+//// CRC-32 of the first image_len bytes of the application; uses the running
+//// digest, so only the bytes after the last in-order subpage are read; the
+//// staged page is programmed first
+uint32_t bootloader_image_crc(const uint32_t image_len) {
+  bootloader_flush();
+  uint32_t crc = 0;
+  uint32_t done = 0;
+  uint32_t full = image_len/BYTES_PER_CMD;
+  if(image_digest.subpages<=full) {           // Digest covers a prefix
+    crc = image_digest.crc;
+    done = image_digest.subpages*BYTES_PER_CMD;
+  } else if(image_digest.subpages==full+1) {  // Last subpage holds padding
+    crc = image_digest.crc_prev;
+    done = full*BYTES_PER_CMD;
+  }                                           // Else start from scratch
+  return crc32(
+   crc, (const uint8_t*)(slot_addr(bl_upload_slot())+done), image_len-done
+  );
+}
+
+//// Non-zero if image_len is valid and the image CRC-32 equals expected_crc
+int bootloader_verify_image(
+ const uint32_t image_len, const uint32_t expected_crc
+) {
+  return
+   image_len>0 && image_len<=APP_MAX_PAGES*BYTES_PER_PAGE &&
+   bootloader_image_crc(image_len)==expected_crc;
+}
+
+int bootloader_verify_xip(
+ const uint32_t image_len, const uint32_t expected_crc
+) {
+  init_qspi();
+  qspi_memory_mapped();
+  return
+   image_len>0 && image_len<=QSPI_FLASH_SIZE &&
+   crc32(0, (const uint8_t*)QSPI_XIP_ADDR, image_len)==expected_crc;
+}
+
 // Protocol functions
 
 //// Attempts to push byte to end of rx_cmd_buff
@@ -230,18 +837,203 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
      (0x0f & rx_cmd_buff_o->data[DEST_ID_INDEX]) << 4 |
      (0xf0 & rx_cmd_buff_o->data[DEST_ID_INDEX]) >> 4;
     // useful variables
-    size_t i     = 0;
-    uint32_t sec = 0;
-    uint32_t ns  = 0;
-    int success  = 0;
+    size_t i       = 0;
+    uint32_t sec   = 0;
+    uint32_t ns    = 0;
+    uint32_t baud  = 0;
+    uint32_t pages = 0;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint8_t reason = 0;
+    uint16_t id    = 0;
+    int success    = 0;
+    slot_state_t slot_state;
+    const cmd_queue_entry_t* entry;
+    job_config_t job_config;
+    uint8_t* report;
     float tsince = 0.0f;
     switch(rx_cmd_buff_o->data[OPCODE_INDEX]) {
+      case APP_ADJ_TIME_OPCODE:
+        // signed nanoseconds to add to the RTC, LSB first
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x0a) &&
+         adjust_rtc(
+          (int32_t)unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX)
+         )
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ACK_OPCODE;
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case APP_GET_JOBS_OPCODE:
+        // reply with the job count, then the configuration and accounting of
+        // each job; see JOB_REPORT_*
+        if(rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x06)) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] =
+           (uint8_t)(0x07+JOB_REPORT_LEN*JOB_COUNT);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = APP_JOBS_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = JOB_COUNT;
+          for(i=0; i<JOB_COUNT; i++) {
+            report = (tx_cmd_buff_o->data)+DATA_START_INDEX+1+JOB_REPORT_LEN*i;
+            report[JOB_REPORT_ENABLED_OFFSET] =
+             (uint8_t)(jobs_config((uint8_t)i)->enabled);
+            pack_uint32(
+             report+JOB_REPORT_PERIOD_OFFSET, jobs_config((uint8_t)i)->period_s
+            );
+            pack_uint32(
+             report+JOB_REPORT_PHASE_OFFSET, jobs_config((uint8_t)i)->phase_s
+            );
+            pack_uint32(
+             report+JOB_REPORT_BUDGET_OFFSET, jobs_config((uint8_t)i)->budget_us
+            );
+            pack_uint32(
+             report+JOB_REPORT_RUNS_OFFSET, jobs_stats((uint8_t)i)->runs
+            );
+            pack_uint32(
+             report+JOB_REPORT_OVERRUNS_OFFSET, jobs_stats((uint8_t)i)->overruns
+            );
+            pack_uint32(
+             report+JOB_REPORT_LAST_US_OFFSET, jobs_stats((uint8_t)i)->last_us
+            );
+            pack_uint32(
+             report+JOB_REPORT_MAX_US_OFFSET, jobs_stats((uint8_t)i)->max_us
+            );
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case APP_GET_QUEUE_OPCODE:
+        // reply with the entry count, then the ID (LSB first), execution time
+        // (LSB first) and opcode of each entry in execution order
+        if(rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x06)) {
+          count = cmd_queue_count();
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = (uint8_t)(0x07+7*count);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = APP_QUEUE_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = (uint8_t)count;
+          for(i=0; i<count; i++) {
+            entry = cmd_queue_entry(i);
+            tx_cmd_buff_o->data[DATA_START_INDEX+1+7*i+0] =
+             (uint8_t)((entry->id >> 0) & 0xff);
+            tx_cmd_buff_o->data[DATA_START_INDEX+1+7*i+1] =
+             (uint8_t)((entry->id >> 8) & 0xff);
+            pack_uint32(
+             (tx_cmd_buff_o->data)+DATA_START_INDEX+1+7*i+2, entry->exec_sec
+            );
+            tx_cmd_buff_o->data[DATA_START_INDEX+1+7*i+6] =
+             entry->frame[OPCODE_INDEX];
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
       case APP_GET_TELEM_OPCODE:
-        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x54);
+        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x62);
         tx_cmd_buff_o->data[OPCODE_INDEX] = APP_TELEM_OPCODE;
-        for(i=DATA_START_INDEX; i<((size_t)0x4e); i++) {
+        for(i=DATA_START_INDEX; i<((size_t)0x65); i++) {
           tx_cmd_buff_o->data[i] = ((uint8_t)0x00);
         }
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_SLEEP_COUNT_OFFSET,
+         sleep_stats.sleep_count
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_WAKE_LATENCY_LAST_OFFSET,
+         sleep_stats.wake_latency_last
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_WAKE_LATENCY_MAX_OFFSET,
+         sleep_stats.wake_latency_max
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BOOT_TO_APP_OFFSET,
+         boot_record_cycles(BOOT_MARK_JUMP_CMD, BOOT_MARK_APP_START)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BOOT_DRAIN_OFFSET,
+         boot_record_cycles(BOOT_MARK_JUMP_CMD, BOOT_MARK_JUMP)
+        );
+        slot_state = slot_read_state();
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_SLOTS_OFFSET,
+         ((uint32_t)slot_mapped()    <<  0) |
+         ((uint32_t)slot_state.active<<  8) |
+         ((uint32_t)slot_state.trial << 16) |
+         ((uint32_t)bl_upload_slot() << 24)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_PROGRAM_PAGE_OFFSET,
+         program_cycles_page
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_PROGRAM_SUBPAGE_OFFSET,
+         program_cycles_subpage
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BLR_CLOCK_OFFSET,
+         boot_record_cycles(BOOT_MARK_BLR_START, BOOT_MARK_BLR_CLOCK)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BLR_UART_OFFSET,
+         boot_record_cycles(BOOT_MARK_BLR_CLOCK, BOOT_MARK_BLR_UART)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BLR_RTC_OFFSET,
+         boot_record_cycles(BOOT_MARK_BLR_UART, BOOT_MARK_BLR_RTC)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BLR_INIT_OFFSET,
+         boot_record_cycles(BOOT_MARK_BLR_RTC, BOOT_MARK_BLR_INIT)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_BLR_BUFFS_OFFSET,
+         boot_record_cycles(BOOT_MARK_BLR_INIT, BOOT_MARK_BLR_READY)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_APP_CLOCK_OFFSET,
+         boot_record_cycles(BOOT_MARK_APP_START, BOOT_MARK_APP_CLOCK)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_APP_UART_OFFSET,
+         boot_record_cycles(BOOT_MARK_APP_CLOCK, BOOT_MARK_APP_UART)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_APP_RTC_OFFSET,
+         boot_record_cycles(BOOT_MARK_APP_UART, BOOT_MARK_APP_RTC)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_APP_INIT_OFFSET,
+         boot_record_cycles(BOOT_MARK_APP_RTC, BOOT_MARK_APP_INIT)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_APP_BUFFS_OFFSET,
+         boot_record_cycles(BOOT_MARK_APP_INIT, BOOT_MARK_APP_READY)
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_LSI_PPM_OFFSET,
+         (uint32_t)lsi_ppm
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_EPHEMERIS_SEC_OFFSET,
+         ephemeris_sec
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_EPHEMERIS_X_OFFSET,
+         (uint32_t)((int32_t)(ephemeris.x*1000.0f))
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_EPHEMERIS_Y_OFFSET,
+         (uint32_t)((int32_t)(ephemeris.y*1000.0f))
+        );
+        pack_uint32(
+         (tx_cmd_buff_o->data)+DATA_START_INDEX+TELEM_EPHEMERIS_Z_OFFSET,
+         (uint32_t)((int32_t)(ephemeris.z*1000.0f))
+        );
         break;
       case APP_GET_TIME_OPCODE:
         // initialize common variables to known values
@@ -273,10 +1065,121 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
           tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
         }
         break;
+      case APP_TIME_STAMPS_OPCODE:
+        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+        tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        break;
+      case APP_TIME_SYNC_OPCODE:
+        // reply with t2 now; tx_usart1 fills in t3 as the reply starts out
+        sec = 0;
+        ns  = 0;
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x06) &&
+         get_rtc_rx_stamp(&sec, &ns)
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x16);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = APP_TIME_STAMPS_OPCODE;
+          pack_uint32(
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+TIME_STAMPS_RX_OFFSET, sec
+          );
+          pack_uint32(
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+TIME_STAMPS_RX_OFFSET+4, ns
+          );
+          pack_uint32(
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+TIME_STAMPS_TX_OFFSET, 0
+          );
+          pack_uint32(
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+TIME_STAMPS_TX_OFFSET+4, 0
+          );
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case APP_JOBS_OPCODE:
+        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+        tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        break;
+      case APP_QUEUE_OPCODE:
+        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+        tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        break;
+      case APP_QUEUE_ADD_OPCODE:
+        // execution time (seconds since J2000), LSB first, then the whole
+        // TAOLST frame to dispatch at that time; reply with the entry ID
+        count = (uint32_t)(rx_cmd_buff_o->data[MSG_LEN_INDEX])-0x0a;
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]>=((uint8_t)0x0a) &&
+         count>=DATA_START_INDEX && count<=CMD_QUEUE_FRAME_MAX &&
+         rx_cmd_buff_o->data[DATA_START_INDEX+4]==START_BYTE_0 &&
+         rx_cmd_buff_o->data[DATA_START_INDEX+5]==START_BYTE_1 &&
+         ((uint32_t)(rx_cmd_buff_o->data[DATA_START_INDEX+6]))+3==count &&
+         cmd_queue_add(
+          unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+          (rx_cmd_buff_o->data)+DATA_START_INDEX+4, (uint8_t)count, &id
+         )
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x08);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ACK_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX+0] = (uint8_t)((id>>0)&0xff);
+          tx_cmd_buff_o->data[DATA_START_INDEX+1] = (uint8_t)((id>>8)&0xff);
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case APP_QUEUE_DELETE_OPCODE:
+        // entry ID, LSB first
+        id = (uint16_t)(
+         (rx_cmd_buff_o->data[DATA_START_INDEX+1]<<8) |
+         rx_cmd_buff_o->data[DATA_START_INDEX+0]
+        );
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x08) &&
+         cmd_queue_delete(id)
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ACK_OPCODE;
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case APP_QUEUE_FLUSH_OPCODE:
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x06) &&
+         cmd_queue_flush()
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ACK_OPCODE;
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
       case APP_REBOOT_OPCODE:
         tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
         tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
         break;
+      case APP_SET_JOB_OPCODE:
+        // job ID, then enabled, period, phase and budget as in APP_JOBS; the
+        // new configuration is persisted
+        report = (rx_cmd_buff_o->data)+DATA_START_INDEX+1;
+        job_config.enabled = (report[JOB_REPORT_ENABLED_OFFSET]!=0);
+        job_config.period_s = unpack_uint32(report+JOB_REPORT_PERIOD_OFFSET);
+        job_config.phase_s = unpack_uint32(report+JOB_REPORT_PHASE_OFFSET);
+        job_config.budget_us = unpack_uint32(report+JOB_REPORT_BUDGET_OFFSET);
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x14) &&
+         jobs_configure(rx_cmd_buff_o->data[DATA_START_INDEX], &job_config)
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ACK_OPCODE;
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
       case APP_SET_TIME_OPCODE:
         ; // empty statement to avoid weird C thing about vars in switch case
         // collect bytes
@@ -314,12 +1217,110 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
         tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
         tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
         break;
+      case BOOTLOADER_CRCS_OPCODE:
+        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+        tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        break;
       case BOOTLOADER_ERASE_OPCODE:
-        if(bootloader_running()) {
-          success = bootloader_erase();
-          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x07);
-          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
-          tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_ERASED;
+        if(bl_upload_allowed()) {
+          // image length is sent LSB first; without it, erase all app pages.
+          // With an image ID and CRC-32 as well, a matching session resumes
+          reason = BOOTLOADER_ACK_REASON_ERASED;
+          if(rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x12)) {
+            pages = bootloader_resume(
+             unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+             unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4),
+             unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+8)
+            );
+            if(pages) {
+              reason = BOOTLOADER_ACK_REASON_RESUME;
+            } else {
+              pages = bootloader_erase(
+               unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+               unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4),
+               unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+8)
+              );
+            }
+          } else if(rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x0a)) {
+            pages = bootloader_erase(
+             unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX), 0, 0
+            );
+          } else {
+            pages = bootloader_erase(APP_MAX_PAGES*BYTES_PER_PAGE, 0, 0);
+          }
+          if(pages) {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x08);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+            tx_cmd_buff_o->data[DATA_START_INDEX] = reason;
+            tx_cmd_buff_o->data[DATA_START_INDEX+1] = (uint8_t)pages;
+          } else {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_FLUSH_OPCODE:
+        if(bl_upload_allowed()) {
+          if(bootloader_flush()) {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x07);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+            tx_cmd_buff_o->data[DATA_START_INDEX] =
+             BOOTLOADER_ACK_REASON_FLUSH;
+          } else {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_GAPS_OPCODE:
+        tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+        tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        break;
+      case BOOTLOADER_GET_CRCS_OPCODE:
+        // first subpage ID, then subpage count; reply with one CRC per subpage
+        first = (uint32_t)(rx_cmd_buff_o->data[DATA_START_INDEX]);
+        count = (uint32_t)(rx_cmd_buff_o->data[DATA_START_INDEX+1]);
+        if(
+         bl_upload_allowed() &&
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x08) &&
+         count>0 && count<=BOOTLOADER_CRCS_MAX && first+count<=256
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = (uint8_t)(0x08+4*count);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_CRCS_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = (uint8_t)first;
+          tx_cmd_buff_o->data[DATA_START_INDEX+1] = (uint8_t)count;
+          for(i=0; i<count; i++) {
+            pack_uint32(
+             (tx_cmd_buff_o->data)+DATA_START_INDEX+2+4*i,
+             bootloader_subpage_crc(first+i)
+            );
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_GET_GAPS_OPCODE:
+        // first subpage ID; reply with range count, then first and last
+        // subpage ID of each missing range; query again after the last range
+        if(
+         bl_upload_allowed() &&
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x07)
+        ) {
+          bootloader_flush();                 // Staged subpages count as sent
+          count = bootloader_gaps(
+           (uint32_t)(rx_cmd_buff_o->data[DATA_START_INDEX]),
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+1, BOOTLOADER_GAPS_MAX
+          );
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = (uint8_t)(0x07+2*count);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_GAPS_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = (uint8_t)count;
         } else {
           tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
           tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
@@ -339,8 +1340,78 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
           tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
         }
         break;
+      case BOOTLOADER_SELECT_OPCODE:
+        // image length, then CRC-32, LSB first; the upload slot boots next
+        if(
+         slots_enabled() &&
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x0e) &&
+         bootloader_verify_image(
+          unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+          unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4)
+         ) &&
+         slot_append(
+          SLOT_RECORD_SELECT, bl_upload_slot(),
+          unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+          unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4)
+         )
+        ) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x08);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_SLOT;
+          tx_cmd_buff_o->data[DATA_START_INDEX+1] = (uint8_t)bl_upload_slot();
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_UPDATE_OPCODE:
+        if(bl_upload_allowed()) {
+          // initialize common variables to known values
+          success = 0;
+          success = bootloader_update_data(rx_cmd_buff_o);
+          if(success) {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x08);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+            tx_cmd_buff_o->data[DATA_START_INDEX] =
+             rx_cmd_buff_o->data[DATA_START_INDEX];
+            tx_cmd_buff_o->data[DATA_START_INDEX+1] = (uint8_t)success;
+          } else {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_PATCH_OPCODE:
+        if(bl_upload_allowed() && bootloader_patch(rx_cmd_buff_o)) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x0b);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_PATCH;
+          pack_uint32(
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+1, lz_state.in_offset
+          );
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_WRITE_LZ_OPCODE:
+        if(bl_upload_allowed() && bootloader_write_lz(rx_cmd_buff_o)) {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x0b);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+          tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_LZ;
+          pack_uint32(
+           (tx_cmd_buff_o->data)+DATA_START_INDEX+1, lz_state.in_offset
+          );
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+        }
+        break;
       case BOOTLOADER_WRITE_PAGE_OPCODE:
-        if(bootloader_running()) {
+        if(bl_upload_allowed()) {
           // initialize common variables to known values
           success = 0;
           success = bootloader_write_data(rx_cmd_buff_o);
@@ -360,10 +1431,63 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
         break;
       case BOOTLOADER_JUMP_OPCODE:
         if(bootloader_running()) {
-          app_jump_pending = 1;
-          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x07);
-          tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
-          tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_JUMP;
+          success = bootloader_flush();       // Program any staged page
+          // image length, then CRC-32, LSB first; refuse to jump on mismatch.
+          // The short form needs the digest recorded when the slot was
+          // selected (with one bank, by the last long form) to match, as for
+          // auto_boot. The long form selects the verified image, so the jump
+          // boots it on trial; with one bank there is nothing to fall back
+          // to, so it is confirmed outright. Either way the jump is refused
+          // if that record cannot be written
+          if(
+           success &&
+           ((rx_cmd_buff_o->data[MSG_LEN_INDEX]==BOOTLOADER_JUMP_LEN &&
+             slot_verify_boot_target(APP_MAX_PAGES*BYTES_PER_PAGE)) ||
+            (rx_cmd_buff_o->data[MSG_LEN_INDEX]==BOOTLOADER_JUMP_VERIFIED_LEN &&
+             bootloader_verify_image(
+              unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+              unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4)
+             ) &&
+             slot_append(
+              slots_enabled() ? SLOT_RECORD_SELECT : SLOT_RECORD_CONFIRM,
+              bl_upload_slot(),
+              unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+              unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4)
+             )))
+          ) {
+            app_jump_pending = APP_JUMP_SLOT;
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x07);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+            tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_JUMP;
+          } else {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+          }
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
+      case BOOTLOADER_JUMP_XIP_OPCODE:
+        if(bootloader_running()) {
+          // image length, then CRC-32, LSB first, of the image in QSPI flash;
+          // refuse to jump on mismatch
+          if(
+           rx_cmd_buff_o->data[MSG_LEN_INDEX]==BOOTLOADER_JUMP_VERIFIED_LEN &&
+           bootloader_verify_xip(
+            unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX),
+            unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX+4)
+           )
+          ) {
+            bootloader_flush();               // Program any staged page
+            app_jump_pending = APP_JUMP_XIP;  // Stack pointer checked at jump
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x07);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_ACK_OPCODE;
+            tx_cmd_buff_o->data[DATA_START_INDEX] = BOOTLOADER_ACK_REASON_JUMP;
+          } else {
+            tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+            tx_cmd_buff_o->data[OPCODE_INDEX] = BOOTLOADER_NACK_OPCODE;
+          }
         } else {
           tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
           tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
@@ -382,13 +1506,11 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
           // Parse TLE
           tle = parse_tle((char*)((rx_cmd_buff_o->data)+DATA_START_INDEX+3));
           tle_epoch = get_tle_epoch(&tle);
+          sgp4_init(&tle,&sgp4_state);
           // Calculate position
           now = get_date_time_rtc();
           tsince = calc_tdiff_minute(&now,&tle_epoch);
-          eci_posn = sgp4(
-           tle.bstar, tle.inclination, tle.raan, tle.eccentricity,
-           tle.arg_of_perigee, tle.mean_anomaly, tle.mean_motion, tsince
-          );
+          eci_posn = sgp4_propagate(&sgp4_state,tsince);
           // Assemble reply
           tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x50);
           tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ASCII_OPCODE;
@@ -493,6 +1615,22 @@ void write_reply(rx_cmd_buff_t* rx_cmd_buff_o, tx_cmd_buff_t* tx_cmd_buff_o) {
         tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
         tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
         break;
+      case COMMON_SET_BAUD_OPCODE:
+        // baud rate is sent LSB first; the switch happens in baud_usart1 once
+        // this ACK has fully drained
+        baud = unpack_uint32((rx_cmd_buff_o->data)+DATA_START_INDEX);
+        if(
+         rx_cmd_buff_o->data[MSG_LEN_INDEX]==((uint8_t)0x0a) &&
+         uart_baud_supported(baud)
+        ) {
+          uart_baud_pending = baud;
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_ACK_OPCODE;
+        } else {
+          tx_cmd_buff_o->data[MSG_LEN_INDEX] = ((uint8_t)0x06);
+          tx_cmd_buff_o->data[OPCODE_INDEX] = COMMON_NACK_OPCODE;
+        }
+        break;
       default:
         break;
     }
@@ -22,26 +22,127 @@
 #define START_BYTE_1 ((uint8_t)0x69)
 
 //// Opcodes
+#define APP_ADJ_TIME_OPCODE          ((uint8_t)0x42) // Not originally in openlst
+#define APP_GET_JOBS_OPCODE          ((uint8_t)0x43) // Not originally in openlst
+#define APP_GET_QUEUE_OPCODE         ((uint8_t)0x3c) // Not originally in openlst
 #define APP_GET_TELEM_OPCODE         ((uint8_t)0x17)
 #define APP_GET_TIME_OPCODE          ((uint8_t)0x13)
+#define APP_JOBS_OPCODE              ((uint8_t)0x44) // Not originally in openlst
+#define APP_QUEUE_OPCODE             ((uint8_t)0x3d) // Not originally in openlst
+#define APP_QUEUE_ADD_OPCODE         ((uint8_t)0x3b) // Not originally in openlst
+#define APP_QUEUE_DELETE_OPCODE      ((uint8_t)0x3e) // Not originally in openlst
+#define APP_QUEUE_FLUSH_OPCODE       ((uint8_t)0x3f) // Not originally in openlst
 #define APP_REBOOT_OPCODE            ((uint8_t)0x12)
+#define APP_SET_JOB_OPCODE           ((uint8_t)0x45) // Not originally in openlst
 #define APP_SET_TIME_OPCODE          ((uint8_t)0x14)
 #define APP_TELEM_OPCODE             ((uint8_t)0x18)
+#define APP_TIME_STAMPS_OPCODE       ((uint8_t)0x41) // Not originally in openlst
+#define APP_TIME_SYNC_OPCODE         ((uint8_t)0x40) // Not originally in openlst
 #define BOOTLOADER_ACK_OPCODE        ((uint8_t)0x01)
+#define BOOTLOADER_CRCS_OPCODE       ((uint8_t)0x32) // Not originally in openlst
 #define BOOTLOADER_ERASE_OPCODE      ((uint8_t)0x0c)
+#define BOOTLOADER_FLUSH_OPCODE      ((uint8_t)0x35) // Not originally in openlst
+#define BOOTLOADER_GAPS_OPCODE       ((uint8_t)0x37) // Not originally in openlst
+#define BOOTLOADER_GET_CRCS_OPCODE   ((uint8_t)0x31) // Not originally in openlst
+#define BOOTLOADER_GET_GAPS_OPCODE   ((uint8_t)0x36) // Not originally in openlst
 #define BOOTLOADER_NACK_OPCODE       ((uint8_t)0x0f)
+#define BOOTLOADER_PATCH_OPCODE      ((uint8_t)0x3a) // Not originally in openlst
 #define BOOTLOADER_PING_OPCODE       ((uint8_t)0x00)
+#define BOOTLOADER_SELECT_OPCODE     ((uint8_t)0x34) // Not originally in openlst
+#define BOOTLOADER_UPDATE_OPCODE     ((uint8_t)0x33) // Not originally in openlst
+#define BOOTLOADER_WRITE_LZ_OPCODE   ((uint8_t)0x38) // Not originally in openlst
 #define BOOTLOADER_WRITE_PAGE_OPCODE ((uint8_t)0x02)
 #define BOOTLOADER_JUMP_OPCODE       ((uint8_t)0x0b)
+#define BOOTLOADER_JUMP_XIP_OPCODE   ((uint8_t)0x39) // Not originally in openlst
 #define COMMON_ACK_OPCODE            ((uint8_t)0x10)
 #define COMMON_ASCII_OPCODE          ((uint8_t)0x11)
 #define COMMON_NACK_OPCODE           ((uint8_t)0xff)
+#define COMMON_SET_BAUD_OPCODE       ((uint8_t)0x30) // Not originally in openlst
 
 //// BOOTLOADER_ACK reasons
 #define BOOTLOADER_ACK_REASON_PONG   ((uint8_t)0x00)
-#define BOOTLOADER_ACK_REASON_ERASED ((uint8_t)0x01)
+#define BOOTLOADER_ACK_REASON_ERASED ((uint8_t)0x01) // Followed by page count
+#define BOOTLOADER_ACK_REASON_SLOT   ((uint8_t)0x02) // Followed by slot ID
+#define BOOTLOADER_ACK_REASON_FLUSH  ((uint8_t)0x03)
+#define BOOTLOADER_ACK_REASON_RESUME ((uint8_t)0x04) // Followed by page count
+#define BOOTLOADER_ACK_REASON_LZ     ((uint8_t)0x05) // Followed by next offset
+#define BOOTLOADER_ACK_REASON_PATCH  ((uint8_t)0x06) // Followed by next offset
 #define BOOTLOADER_ACK_REASON_JUMP   ((uint8_t)0xff)
 
+//// BOOTLOADER_UPDATE results; the ACK carries the subpage ID, then the result
+#define BOOTLOADER_UPDATE_WRITTEN    ((uint8_t)0x01) // Blank subpage programmed
+#define BOOTLOADER_UPDATE_SKIPPED    ((uint8_t)0x02) // Flash already matched
+#define BOOTLOADER_UPDATE_REWRITTEN  ((uint8_t)0x03) // Page erased, rewritten
+
+//// BOOTLOADER_JUMP message lengths; the long form carries the image length
+//// and its CRC-32, LSB first, and the jump is refused if they do not match.
+//// The short form is refused unless the boot target matches the digest it
+//// was selected with: by BOOTLOADER_SELECT or a long BOOTLOADER_JUMP, or with
+//// one bank by the last long BOOTLOADER_JUMP
+#define BOOTLOADER_JUMP_LEN          ((uint8_t)0x06)
+#define BOOTLOADER_JUMP_VERIFIED_LEN ((uint8_t)0x0e)
+
+//// app_jump_pending values; BOOTLOADER_JUMP starts the flash slot chosen by
+//// slot_boot_target, BOOTLOADER_JUMP_XIP executes in place from QSPI flash.
+//// BOOTLOADER_JUMP_XIP only takes the long form, checked against the image at
+//// QSPI_XIP_ADDR
+#define APP_JUMP_NONE                ((int)0)
+#define APP_JUMP_SLOT                ((int)1)
+#define APP_JUMP_XIP                 ((int)2)
+
+//// BOOTLOADER_GET_CRCS limit; the reply holds one 4-byte CRC-32 per subpage
+#define BOOTLOADER_CRCS_MAX          ((uint8_t)60)
+
+//// BOOTLOADER_GET_GAPS limit; the reply holds first and last subpage IDs
+//// of each missing range
+#define BOOTLOADER_GAPS_MAX          ((uint8_t)60)
+
+//// APP_TELEM fields; offsets are from DATA_START_INDEX, values are LSB first
+#define TELEM_SLEEP_COUNT_OFFSET       ((size_t)0)
+#define TELEM_WAKE_LATENCY_LAST_OFFSET ((size_t)4)
+#define TELEM_WAKE_LATENCY_MAX_OFFSET  ((size_t)8)
+#define TELEM_BOOT_TO_APP_OFFSET       ((size_t)12) // JUMP cmd to app main
+#define TELEM_BOOT_DRAIN_OFFSET        ((size_t)16) // JUMP cmd to jump
+#define TELEM_SLOTS_OFFSET             ((size_t)20) // Slot IDs, 1 byte each
+#define TELEM_PROGRAM_PAGE_OFFSET      ((size_t)24) // Cycles, last page
+#define TELEM_PROGRAM_SUBPAGE_OFFSET   ((size_t)28) // Cycles, last subpage
+#define TELEM_BLR_CLOCK_OFFSET         ((size_t)32) // Boot stage cycles
+#define TELEM_BLR_UART_OFFSET          ((size_t)36)
+#define TELEM_BLR_RTC_OFFSET           ((size_t)40)
+#define TELEM_BLR_INIT_OFFSET          ((size_t)44)
+#define TELEM_BLR_BUFFS_OFFSET         ((size_t)48)
+#define TELEM_APP_CLOCK_OFFSET         ((size_t)52)
+#define TELEM_APP_UART_OFFSET          ((size_t)56)
+#define TELEM_APP_RTC_OFFSET           ((size_t)60)
+#define TELEM_APP_INIT_OFFSET          ((size_t)64)
+#define TELEM_APP_BUFFS_OFFSET         ((size_t)68)
+#define TELEM_LSI_PPM_OFFSET           ((size_t)72) // Signed, vs. 32 kHz
+#define TELEM_EPHEMERIS_SEC_OFFSET     ((size_t)76) // J2000 s; 0 if none
+#define TELEM_EPHEMERIS_X_OFFSET       ((size_t)80) // ECI, signed metres
+#define TELEM_EPHEMERIS_Y_OFFSET       ((size_t)84)
+#define TELEM_EPHEMERIS_Z_OFFSET       ((size_t)88)
+
+//// APP_JOBS fields; the job count, then JOB_REPORT_LEN bytes per job in ID
+//// order. APP_SET_JOB carries the job ID, then the first 13 bytes of these
+#define JOB_REPORT_ENABLED_OFFSET  ((size_t)0)  // 1 byte
+#define JOB_REPORT_PERIOD_OFFSET   ((size_t)1)  // Seconds
+#define JOB_REPORT_PHASE_OFFSET    ((size_t)5)  // Seconds
+#define JOB_REPORT_BUDGET_OFFSET   ((size_t)9)  // Microseconds
+#define JOB_REPORT_RUNS_OFFSET     ((size_t)13)
+#define JOB_REPORT_OVERRUNS_OFFSET ((size_t)17)
+#define JOB_REPORT_LAST_US_OFFSET  ((size_t)21)
+#define JOB_REPORT_MAX_US_OFFSET   ((size_t)25)
+#define JOB_REPORT_LEN             ((size_t)29)
+
+//// APP_TIME_STAMPS fields, each seconds then nanoseconds since J2000, LSB
+//// first: t2, when the last byte of the APP_TIME_SYNC arrived, and t3, when
+//// the first byte of the reply went out. With t1 and t4 taken on the ground
+//// as the last request byte leaves and the first reply byte arrives, the
+//// clock offset is ((t2-t1)+(t3-t4))/2 and the round trip delay is
+//// (t4-t1)-(t3-t2); APP_ADJ_TIME applies the correction, in signed ns
+#define TIME_STAMPS_RX_OFFSET          ((size_t)0)
+#define TIME_STAMPS_TX_OFFSET          ((size_t)8)
+
 //// Destination IDs
 #define DEST_COMM ((uint8_t)0x01)
 #define DEST_CTRL ((uint8_t)0x0a)
@@ -53,8 +154,65 @@
 #define BYTES_PER_CMD  ((uint32_t)128)
 #define BYTES_PER_PAGE ((uint32_t)2048)
 
+//// Subpages staged in RAM until their page is programmed
+#define SUBPAGES_PER_PAGE ((uint32_t)(BYTES_PER_PAGE/BYTES_PER_CMD))
+#define STAGED_PAGE_NONE  ((uint32_t)0xffffffff)
+
+//// BOOTLOADER_WRITE_LZ stream format: a control byte c below 0x80 is followed
+//// by c+1 literal bytes; otherwise (c&0x7f)+LZ_MATCH_MIN bytes are copied from
+//// d bytes back in the image, where d follows in two bytes, LSB first. Matches
+//// may overlap the bytes they produce. See the lz-compressor utility
+#define LZ_MATCH_MIN       ((uint32_t)3)
+#define LZ_STATE_CONTROL   ((uint8_t)0x00)
+#define LZ_STATE_LITERAL   ((uint8_t)0x01)
+#define LZ_STATE_DIST_LSB  ((uint8_t)0x02)
+#define LZ_STATE_DIST_MSB  ((uint8_t)0x03)
+#define LZ_STATE_FAILED    ((uint8_t)0xff)
+
+//// BOOTLOADER_PATCH stream format: an 8-byte header holding the length and
+//// CRC-32 of the old image (the image in the other slot), LSB first, then a
+//// sequence of ops. Each op is an op byte and a LEB128 argument n: COPY
+//// copies n bytes from the old image cursor, ADD adds the n bytes that follow
+//// to as many bytes from the old image cursor, INSERT copies the n bytes that
+//// follow, and SEEK moves the old image cursor by the zigzag-decoded n. COPY
+//// and ADD advance the cursor. See the delta-patch utility
+#define PATCH_HEADER_LEN      ((uint8_t)8)
+#define PATCH_ARG_BYTES_MAX   ((uint8_t)5)
+#define PATCH_OP_COPY         ((uint8_t)0x00)
+#define PATCH_OP_ADD          ((uint8_t)0x01)
+#define PATCH_OP_INSERT       ((uint8_t)0x02)
+#define PATCH_OP_SEEK         ((uint8_t)0x03)
+#define LZ_STATE_PATCH_HEADER ((uint8_t)0x10)
+#define LZ_STATE_PATCH_OP     ((uint8_t)0x11)
+#define LZ_STATE_PATCH_ARG    ((uint8_t)0x12)
+#define LZ_STATE_PATCH_DATA   ((uint8_t)0x13)
+
 // Typedefs
 
+//// BOOTLOADER_WRITE_LZ and BOOTLOADER_PATCH decoder state; the image
+//// decompressed so far is the match history (the page being assembled in
+//// RAM, earlier pages in flash) and the old image of a patch is the other
+//// slot, so the decoder needs no window buffer of its own
+typedef struct lz_state {
+  uint32_t in_offset; // Compressed bytes consumed since BOOTLOADER_ERASE
+  uint32_t out_len;   // Image bytes produced since BOOTLOADER_ERASE
+  uint32_t distance;  // Match distance being read
+  uint32_t old_len;   // Patch: old image length from the header
+  uint32_t old_pos;   // Patch: old image cursor
+  uint32_t arg;       // Patch: header CRC-32, or op argument being read
+  uint8_t  state;     // LZ_STATE_*
+  uint8_t  count;     // Literal bytes left, or match length; patch: argument
+                      //  or header bytes read
+  uint8_t  op;        // Patch: PATCH_OP_* being decoded
+} lz_state_t;
+
+//// Running CRC-32 of the image, extended as subpages are written in order
+typedef struct image_digest {
+  uint32_t crc;      // CRC-32 of subpages 0 through subpages-1
+  uint32_t crc_prev; // CRC-32 of subpages 0 through subpages-2
+  uint32_t subpages; // Number of leading subpages covered by crc
+} image_digest_t;
+
 //// TAOLST command indices
 typedef enum cmd_index {
   START_BYTE_0_INDEX = ((size_t)0),
@@ -113,14 +271,82 @@ void clear_tx_cmd_buff(tx_cmd_buff_t* tx_cmd_buff_o);
 //// Indicates whether MCU is in bootloader mode or application mode
 int bootloader_running(void);
 
+//// Writes val into data[0] through data[3], LSB first
+void pack_uint32(uint8_t* data, const uint32_t val);
+
+//// Reads a uint32_t from data[0] through data[3], LSB first
+uint32_t unpack_uint32(const uint8_t* data);
+
 // Command functions
 
-//// BOOTLOADER_ERASE
-int bootloader_erase(void);
+//// BOOTLOADER_ERASE; erases the pages covered by an image of image_len bytes
+//// and starts an upload session for it. Returns the number of pages erased,
+//// or 0 if image_len is invalid
+uint32_t bootloader_erase(
+ const uint32_t image_len, const uint32_t image_id, const uint32_t image_crc
+);
+
+//// BOOTLOADER_ERASE with an image ID; if the stored upload session is for the
+//// same image and slot, picks it up without erasing. Returns the number of
+//// pages erased by that session, or 0 if there is no matching session
+uint32_t bootloader_resume(
+ const uint32_t image_len, const uint32_t image_id, const uint32_t image_crc
+);
+
+//// BOOTLOADER_GET_GAPS; writes the first and last subpage ID of up to max
+//// ranges of the upload session not yet in flash, starting at subpage first.
+//// Returns the number of ranges written
+uint32_t bootloader_gaps(
+ const uint32_t first, uint8_t* ranges_o, const uint32_t max
+);
 
-//// Given a well-formed BOOTLOADER_WRITE_PAGE command, write data to flash
+//// Given a well-formed BOOTLOADER_WRITE_PAGE command, stage data in the page
+//// buffer; the page is programmed once all of its subpages are staged or on
+//// bootloader_flush. The target page must have been erased by
+//// BOOTLOADER_ERASE
 int bootloader_write_data(rx_cmd_buff_t* rx_cmd_buff);
 
+//// BOOTLOADER_FLUSH; programs the staged page, if any, in one pass. Returns 0
+//// if programming failed
+int bootloader_flush(void);
+
+//// Given a well-formed BOOTLOADER_WRITE_LZ command, decompress the part of its
+//// data not yet consumed into the page buffer; a chunk past the expected
+//// offset is ignored. Returns 0 if the stream is corrupt or runs past the
+//// erased pages, else non-zero; lz_state.in_offset is the next offset
+int bootloader_write_lz(rx_cmd_buff_t* rx_cmd_buff);
+
+//// Given a well-formed BOOTLOADER_PATCH command, apply the part of its data
+//// not yet consumed, reading the old image from the other slot; framed like
+//// BOOTLOADER_WRITE_LZ. Returns 0 if the old image does not match the header,
+//// the patch is corrupt, or there is no other slot, else non-zero
+int bootloader_patch(rx_cmd_buff_t* rx_cmd_buff);
+
+//// Given a well-formed BOOTLOADER_UPDATE command, bring one subpage of flash
+//// up to date without a prior BOOTLOADER_ERASE; only a page whose programmed
+//// content differs is erased. Returns a BOOTLOADER_UPDATE result or 0
+int bootloader_update_data(rx_cmd_buff_t* rx_cmd_buff);
+
+//// CRC-32 (as computed by crc32) of the flash content of one subpage; the
+//// staged page is programmed first
+uint32_t bootloader_subpage_crc(const uint32_t subpage_id);
+
+//// CRC-32 of the first image_len bytes of the application; uses the running
+//// digest, so only the bytes after the last in-order subpage are read; the
+//// staged page is programmed first
+uint32_t bootloader_image_crc(const uint32_t image_len);
+
+//// Non-zero if image_len is valid and the image CRC-32 equals expected_crc
+int bootloader_verify_image(
+ const uint32_t image_len, const uint32_t expected_crc
+);
+
+//// As bootloader_verify_image, for an image at QSPI_XIP_ADDR; maps the QSPI
+//// flash to read it
+int bootloader_verify_xip(
+ const uint32_t image_len, const uint32_t expected_crc
+);
+
 // Protocol functions
 
 //// Attempts to push byte to end of rx_cmd_buff
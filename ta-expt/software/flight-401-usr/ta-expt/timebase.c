@@ -0,0 +1,94 @@
+// timebase.c
+// Tartan Artibeus EXPT board monotonic timebase implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stdint.h>                 // uint32_t, uint64_t
+
+// libopencm3 library
+#include <libopencm3/cm3/cortex.h>  // used in now_cycles
+#include <libopencm3/cm3/nvic.h>    // used in init_timebase, timebase_stop
+#include <libopencm3/stm32/rcc.h>   // used in init_timebase, timebase_stop
+#include <libopencm3/stm32/timer.h> // TIM2
+
+// ta-expt library
+#include <timebase.h>               // Header file
+
+// Variables
+volatile uint32_t timebase_high = 0; // TIM2 overflows counted by tim2_isr
+
+// Initialization functions
+
+void init_timebase(void) {
+  rcc_periph_clock_enable(RCC_TIM2);
+  rcc_periph_reset_pulse(RST_TIM2);
+  uint32_t timer_frequency =                 // APB1 timer clock is doubled
+   (rcc_apb1_frequency==rcc_ahb_frequency) ? //  when APB1 is divided down
+   rcc_apb1_frequency : 2*rcc_apb1_frequency;
+  timer_set_prescaler(TIM2,timer_frequency/rcc_ahb_frequency-1);
+  timer_set_period(TIM2,0xffffffff);
+  timer_update_on_overflow(TIM2);            // UG below leaves UIF clear
+  timer_generate_event(TIM2,TIM_EGR_UG);     // Load the prescaler
+  timer_clear_flag(TIM2,TIM_SR_UIF);
+  timebase_high = 0;
+  timer_enable_irq(TIM2,TIM_DIER_UIE);
+  nvic_clear_pending_irq(NVIC_TIM2_IRQ);
+  nvic_enable_irq(NVIC_TIM2_IRQ);
+  timer_enable_counter(TIM2);
+}
+
+// Timebase functions
+
+uint64_t now_cycles(void) {
+  uint32_t masked = cm_mask_interrupts(1);
+  uint32_t high = timebase_high;
+  uint32_t low = TIM_CNT(TIM2);
+  if(TIM_SR(TIM2)&TIM_SR_UIF) {              // Overflow tim2_isr has not
+    low = TIM_CNT(TIM2);                     //  counted yet; read again so
+    high += 1;                               //  low is from after it
+  }
+  cm_mask_interrupts(masked);
+  return (((uint64_t)high)<<32)|low;
+}
+
+uint64_t now_us(void) {
+  return now_cycles()/(rcc_ahb_frequency/1000000);
+}
+
+uint64_t cycles_from_ms(const uint32_t ms) {
+  return ((uint64_t)ms)*(rcc_ahb_frequency/1000);
+}
+
+void delay_cycles(const uint64_t cycles) {
+  uint64_t start = now_cycles();
+  while(now_cycles()-start<cycles) {}
+}
+
+void delay_us(const uint32_t us) {
+  delay_cycles(((uint64_t)us)*(rcc_ahb_frequency/1000000));
+}
+
+void delay_ms(const uint32_t ms) {
+  delay_cycles(cycles_from_ms(ms));
+}
+
+void timebase_stop(void) {
+  nvic_disable_irq(NVIC_TIM2_IRQ);
+  rcc_periph_reset_pulse(RST_TIM2);
+  rcc_periph_clock_disable(RCC_TIM2);
+  nvic_clear_pending_irq(NVIC_TIM2_IRQ);
+  timebase_high = 0;
+}
+
+// Interrupt service routines
+
+void tim2_isr(void) {
+  if(timer_get_flag(TIM2,TIM_SR_UIF)) {
+    timer_clear_flag(TIM2,TIM_SR_UIF);
+    timebase_high += 1;
+  }
+}
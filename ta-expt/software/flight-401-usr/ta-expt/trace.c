@@ -0,0 +1,154 @@
+// trace.c
+// Tartan Artibeus EXPT board binary trace stream implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stddef.h>                 // size_t
+#include <stdint.h>                 // uint8_t, uint32_t
+
+// libopencm3 library
+#include <libopencm3/cm3/cortex.h>  // used in trace_event
+#include <libopencm3/cm3/nvic.h>    // used in init_trace, trace_stop
+#include <libopencm3/stm32/dma.h>   // used in trace_kick
+#include <libopencm3/stm32/gpio.h>  // used in init_trace
+#include <libopencm3/stm32/rcc.h>   // used in init_trace, trace_stop
+#include <libopencm3/stm32/usart.h> // used in init_trace, trace_flush
+
+// ta-expt library
+#include <timebase.h>               // used in trace_event
+#include <trace.h>                  // Header file
+
+// Variables
+
+//// Trace ring; trace_event writes head, DMA reads from tail
+uint8_t trace_ring[TRACE_RING_SIZE];
+volatile size_t trace_ring_head = 0;  // Index of next byte to be written
+volatile size_t trace_ring_tail = 0;  // Index of next byte to be sent
+volatile size_t trace_dma_len = 0;    // Bytes in flight; zero if DMA idle
+uint8_t trace_seq = 0;                // 6-bit record sequence number
+trace_stats_t trace_stats = {.records = 0, .dropped = 0};
+
+// Helper functions
+
+//// Starts a DMA transfer of the contiguous bytes after the tail, if any
+//// Must be called with interrupts masked
+static void trace_kick(void) {
+  if(trace_dma_len==0 && trace_ring_head!=trace_ring_tail) {
+    size_t len = (trace_ring_head>trace_ring_tail) ?
+     (trace_ring_head-trace_ring_tail) : (TRACE_RING_SIZE-trace_ring_tail);
+    trace_dma_len = len;
+    dma_disable_channel(DMA2, DMA_CHANNEL3);
+    dma_set_memory_address(
+     DMA2, DMA_CHANNEL3, (uint32_t)(trace_ring+trace_ring_tail)
+    );
+    dma_set_number_of_data(DMA2, DMA_CHANNEL3, (uint16_t)len);
+    dma_enable_channel(DMA2, DMA_CHANNEL3);
+  }
+}
+
+// Initialization functions
+
+void init_trace(void) {
+  rcc_periph_reset_pulse(RST_UART4);
+  rcc_periph_clock_enable(RCC_GPIOA);
+  rcc_periph_clock_enable(RCC_UART4);
+  rcc_periph_clock_enable(RCC_DMA2);
+  gpio_mode_setup(GPIOA,GPIO_MODE_AF,GPIO_PUPD_NONE,GPIO0);
+  gpio_set_af(GPIOA,GPIO_AF8,GPIO0);          // UART4_TX is alternate fnctn 8
+  usart_set_baudrate(UART4,TRACE_BAUD);
+  usart_set_databits(UART4,8);
+  usart_set_stopbits(UART4,USART_STOPBITS_1);
+  usart_set_mode(UART4,USART_MODE_TX);
+  usart_set_parity(UART4,USART_PARITY_NONE);
+  usart_set_flow_control(UART4,USART_FLOWCONTROL_NONE);
+  usart_enable_tx_dma(UART4);
+  usart_enable(UART4);
+  dma_channel_reset(DMA2, DMA_CHANNEL3);
+  dma_set_channel_request(DMA2, DMA_CHANNEL3, 2); // RM0351: UART4_TX is 2
+  dma_set_peripheral_address(DMA2, DMA_CHANNEL3, (uint32_t)&USART_TDR(UART4));
+  dma_set_read_from_memory(DMA2, DMA_CHANNEL3);
+  dma_enable_memory_increment_mode(DMA2, DMA_CHANNEL3);
+  dma_set_peripheral_size(DMA2, DMA_CHANNEL3, DMA_CCR_PSIZE_8BIT);
+  dma_set_memory_size(DMA2, DMA_CHANNEL3, DMA_CCR_MSIZE_8BIT);
+  dma_set_priority(DMA2, DMA_CHANNEL3, DMA_CCR_PL_LOW);
+  dma_enable_transfer_complete_interrupt(DMA2, DMA_CHANNEL3);
+  trace_ring_head = 0;
+  trace_ring_tail = 0;
+  trace_dma_len = 0;
+  nvic_enable_irq(NVIC_DMA2_CHANNEL3_IRQ);
+}
+
+// Trace functions
+
+void trace_event(
+ const uint8_t id, const uint8_t nargs,
+ const uint32_t arg0, const uint32_t arg1
+) {
+  uint8_t n = (nargs<=TRACE_MAX_ARGS) ? nargs : TRACE_MAX_ARGS;
+  size_t len = TRACE_HDR_LEN+4*((size_t)n);
+  uint32_t cycles = (uint32_t)now_cycles();   // Low word; wraps in ~54 s
+  uint32_t args[2] = {arg0, arg1};
+  uint32_t masked = cm_mask_interrupts(1);    // Callable from ISRs
+  size_t used = (trace_ring_head-trace_ring_tail)&(TRACE_RING_SIZE-1);
+  if(used+len<TRACE_RING_SIZE) {              // One slot stays empty
+    uint8_t record[TRACE_HDR_LEN+4*2];
+    record[0] = TRACE_SYNC_BYTE;
+    record[1] = id;
+    record[2] = (uint8_t)((trace_seq<<2)|n);
+    record[3] = (uint8_t)((cycles >>  0) & 0xff); // LSB
+    record[4] = (uint8_t)((cycles >>  8) & 0xff);
+    record[5] = (uint8_t)((cycles >> 16) & 0xff);
+    record[6] = (uint8_t)((cycles >> 24) & 0xff); // MSB
+    for(size_t a=0; a<n; a++) {
+      record[TRACE_HDR_LEN+4*a+0] = (uint8_t)((args[a] >>  0) & 0xff);
+      record[TRACE_HDR_LEN+4*a+1] = (uint8_t)((args[a] >>  8) & 0xff);
+      record[TRACE_HDR_LEN+4*a+2] = (uint8_t)((args[a] >> 16) & 0xff);
+      record[TRACE_HDR_LEN+4*a+3] = (uint8_t)((args[a] >> 24) & 0xff);
+    }
+    for(size_t i=0; i<len; i++) {
+      trace_ring[trace_ring_head] = record[i];
+      trace_ring_head = (trace_ring_head+1)&(TRACE_RING_SIZE-1);
+    }
+    trace_stats.records += 1;
+    trace_kick();
+  } else {
+    trace_stats.dropped += 1;
+  }
+  trace_seq = (trace_seq+1)&0x3f;             // Gap marks a dropped record
+  cm_mask_interrupts(masked);
+}
+
+void trace_flush(void) {
+  while(trace_dma_len!=0 || trace_ring_head!=trace_ring_tail) {}
+  while(!usart_get_flag(UART4,USART_ISR_TC)) {}  // Last stop bit sent
+}
+
+void trace_stop(void) {
+  nvic_disable_irq(NVIC_DMA2_CHANNEL3_IRQ);
+  dma_channel_reset(DMA2, DMA_CHANNEL3);
+  rcc_periph_reset_pulse(RST_UART4);
+  rcc_periph_clock_disable(RCC_UART4);
+  nvic_clear_pending_irq(NVIC_DMA2_CHANNEL3_IRQ);
+  trace_ring_head = 0;
+  trace_ring_tail = 0;
+  trace_dma_len = 0;
+}
+
+trace_stats_t get_trace_stats(void) {
+  return trace_stats;
+}
+
+// Interrupt service routines
+
+void dma2_channel3_isr(void) {
+  if(dma_get_interrupt_flag(DMA2, DMA_CHANNEL3, DMA_TCIF)) {
+    dma_clear_interrupt_flags(DMA2, DMA_CHANNEL3, DMA_TCIF);
+    trace_ring_tail = (trace_ring_tail+trace_dma_len)&(TRACE_RING_SIZE-1);
+    trace_dma_len = 0;
+    trace_kick();                             // Send what arrived meanwhile
+  }
+}
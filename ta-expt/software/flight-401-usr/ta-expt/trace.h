@@ -0,0 +1,100 @@
+// trace.h
+// Tartan Artibeus EXPT board binary trace stream header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Standard library
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t, uint32_t
+
+// Macros
+
+//// Trace UART; TX only, on PA0 (alternate function 8), 8N1
+#define TRACE_BAUD      ((uint32_t)2000000U)
+
+//// Trace RAM ring size; must be a power of two
+#define TRACE_RING_SIZE ((size_t)2048)
+
+//// Record layout: sync, event ID, (sequence<<2)|arg count, 4-byte cycle
+//// timestamp, then 0 to 2 four-byte arguments; all values LSB first
+#define TRACE_SYNC_BYTE ((uint8_t)0xa5)
+#define TRACE_HDR_LEN   ((size_t)7)
+#define TRACE_MAX_ARGS  ((uint8_t)2)
+
+//// Event IDs and their arguments; keep in sync with the trace-decoder utility
+#define TRACE_EVENT_BOOT          ((uint8_t)0x01) // in_bootloader
+#define TRACE_EVENT_CMD           ((uint8_t)0x02) // opcode, msg ID
+#define TRACE_EVENT_REPLY         ((uint8_t)0x03) // opcode, msg length
+#define TRACE_EVENT_WAKE          ((uint8_t)0x04) // none
+#define TRACE_EVENT_BAUD          ((uint8_t)0x05) // new baud rate
+#define TRACE_EVENT_BAUD_FALLBACK ((uint8_t)0x06) // abandoned baud rate
+#define TRACE_EVENT_JUMP          ((uint8_t)0x07) // jump address
+#define TRACE_EVENT_LSI_CAL       ((uint8_t)0x08) // LSI ppm, RTC ppm left
+#define TRACE_EVENT_QUEUE_RUN     ((uint8_t)0x09) // entry ID, exec time
+#define TRACE_EVENT_TIME_ADJ      ((uint8_t)0x0a) // offset ns, 1 if step
+#define TRACE_EVENT_JOB_OVERRUN   ((uint8_t)0x0b) // job ID, us; 0 if missed
+#define TRACE_EVENT_BEACON        ((uint8_t)0x0c) // sleep count, overruns
+#define TRACE_EVENT_SLOT_FAIL     ((uint8_t)0x0d) // record type, slot
+
+//// Convenience wrappers
+#define TRACE0(id)       trace_event((id), 0, 0, 0)
+#define TRACE1(id, a)    trace_event((id), 1, (uint32_t)(a), 0)
+#define TRACE2(id, a, b) trace_event((id), 2, (uint32_t)(a), (uint32_t)(b))
+
+// Typedefs
+
+//// Trace statistics
+typedef struct trace_stats {
+  uint32_t records; // Records written to the ring
+  uint32_t dropped; // Records discarded because the ring was full
+} trace_stats_t;
+
+// Initialization functions
+
+/*  void init_trace(void)
+ *    Sets up UART4 TX on PA0 and DMA2 channel 3 to drain the trace ring
+ */
+void init_trace(void);
+
+// Trace functions
+
+/*  void trace_event(
+ *   const uint8_t id, const uint8_t nargs,
+ *   const uint32_t arg0, const uint32_t arg1
+ *  )
+ *    id:    event ID; see TRACE_EVENT_*
+ *    nargs: number of arguments to record (0 through TRACE_MAX_ARGS)
+ *    arg0:  first argument; ignored if nargs<1
+ *    arg1:  second argument; ignored if nargs<2
+ *  Safe to call from interrupt handlers; never blocks. If the ring is full
+ *  the record is dropped and the sequence number gap shows up in the decoder.
+ */
+void trace_event(
+ const uint8_t id, const uint8_t nargs,
+ const uint32_t arg0, const uint32_t arg1
+);
+
+/*  void trace_flush(void)
+ *    Blocks until every record in the ring has left UART4; needs interrupts
+ */
+void trace_flush(void);
+
+/*  void trace_stop(void)
+ *    Disables the trace DMA interrupt and resets UART4 and DMA2 channel 3, e.g.
+ *    before the bootloader jumps to the application
+ */
+void trace_stop(void);
+
+/*  trace_stats_t get_trace_stats(void)
+ *  Return:
+ *    Copy of the trace record and drop counters
+ */
+trace_stats_t get_trace_stats(void);
+
+#endif
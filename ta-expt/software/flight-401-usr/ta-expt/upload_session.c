@@ -0,0 +1,66 @@
+// upload_session.c
+// Tartan Artibeus EXPT board resumable upload session implementation file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// Standard library
+#include <stdint.h>                 // uint8_t, uint32_t
+
+// libopencm3 library
+#include <libopencm3/stm32/pwr.h>   // used in upload_session_start, mark
+#include <libopencm3/stm32/rtc.h>   // RTC_BKPXR
+
+// ta-expt library
+#include <upload_session.h>         // Header file
+
+// Upload session functions
+
+int upload_session_read(upload_session_t* session_o) {
+  if(RTC_BKPXR(UPLOAD_SESSION_BKP_MAGIC)!=UPLOAD_SESSION_MAGIC) {
+    return 0;
+  }
+  uint32_t info = RTC_BKPXR(UPLOAD_SESSION_BKP_INFO);
+  session_o->image_id = RTC_BKPXR(UPLOAD_SESSION_BKP_ID);
+  session_o->image_len = RTC_BKPXR(UPLOAD_SESSION_BKP_LEN);
+  session_o->image_crc = RTC_BKPXR(UPLOAD_SESSION_BKP_CRC);
+  session_o->slot = (uint8_t)((info >> 0) & 0xff);
+  session_o->pages = (uint8_t)((info >> 8) & 0xff);
+  return 1;
+}
+
+void upload_session_start(const upload_session_t* session) {
+  pwr_disable_backup_domain_write_protect();
+  RTC_BKPXR(UPLOAD_SESSION_BKP_MAGIC) = 0;     // Invalid until complete
+  RTC_BKPXR(UPLOAD_SESSION_BKP_ID) = session->image_id;
+  RTC_BKPXR(UPLOAD_SESSION_BKP_LEN) = session->image_len;
+  RTC_BKPXR(UPLOAD_SESSION_BKP_CRC) = session->image_crc;
+  RTC_BKPXR(UPLOAD_SESSION_BKP_INFO) =
+   ((uint32_t)(session->slot) << 0) | ((uint32_t)(session->pages) << 8);
+  for(uint32_t i=0; i<UPLOAD_SESSION_WORDS; i++) {
+    RTC_BKPXR(UPLOAD_SESSION_BKP_BITMAP+i) = 0;
+  }
+  RTC_BKPXR(UPLOAD_SESSION_BKP_MAGIC) = UPLOAD_SESSION_MAGIC;
+  pwr_enable_backup_domain_write_protect();
+}
+
+void upload_session_mark(const uint32_t subpage_id) {
+  if(
+   RTC_BKPXR(UPLOAD_SESSION_BKP_MAGIC)==UPLOAD_SESSION_MAGIC &&
+   subpage_id<32*UPLOAD_SESSION_WORDS && !upload_session_received(subpage_id)
+  ) {
+    pwr_disable_backup_domain_write_protect();
+    RTC_BKPXR(UPLOAD_SESSION_BKP_BITMAP+subpage_id/32) |=
+     ((uint32_t)1)<<(subpage_id%32);
+    pwr_enable_backup_domain_write_protect();
+  }
+}
+
+int upload_session_received(const uint32_t subpage_id) {
+  return
+   subpage_id<32*UPLOAD_SESSION_WORDS &&
+   (RTC_BKPXR(UPLOAD_SESSION_BKP_BITMAP+subpage_id/32) &
+    (((uint32_t)1)<<(subpage_id%32)))!=0;
+}
@@ -0,0 +1,67 @@
+// upload_session.h
+// Tartan Artibeus EXPT board resumable upload session header file
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+#ifndef UPLOAD_SESSION_H
+#define UPLOAD_SESSION_H
+
+// Standard library
+#include <stdint.h> // uint8_t, uint32_t
+
+// Macros
+
+//// Session location; RTC backup registers 0 through 12, which keep their
+//// content across resets (and power loss while VBAT is supplied)
+#define UPLOAD_SESSION_BKP_MAGIC  ((uint32_t)0)
+#define UPLOAD_SESSION_BKP_ID     ((uint32_t)1)
+#define UPLOAD_SESSION_BKP_LEN    ((uint32_t)2)
+#define UPLOAD_SESSION_BKP_CRC    ((uint32_t)3)
+#define UPLOAD_SESSION_BKP_INFO   ((uint32_t)4)  // Slot, then erased pages
+#define UPLOAD_SESSION_BKP_BITMAP ((uint32_t)5)  // First of 8 bitmap words
+#define UPLOAD_SESSION_WORDS      ((uint32_t)8)  // 256 subpages, 1 bit each
+
+//// Session identification; bump the version whenever the layout changes
+#define UPLOAD_SESSION_MAGIC      ((uint32_t)0x31505055U) // "UPP1", LSB first
+
+// Typedefs
+
+//// Upload session header; the image ID is chosen by the ground
+typedef struct upload_session {
+  uint32_t image_id;  // Ground-assigned image identifier
+  uint32_t image_len; // Image length in bytes
+  uint32_t image_crc; // Expected image CRC-32
+  uint8_t  slot;      // Slot being uploaded; see slots.h
+  uint8_t  pages;     // Pages erased for the image
+} upload_session_t;
+
+// Upload session functions
+
+/*  int upload_session_read(upload_session_t* session_o)
+ *    session_o: filled in with the stored session header if there is one
+ *  Return:
+ *    0 to indicate there is no session
+ *    Non-zero to indicate session_o holds the stored session
+ */
+int upload_session_read(upload_session_t* session_o);
+
+/*  void upload_session_start(const upload_session_t* session)
+ *    Stores session and clears its received-subpage bitmap
+ */
+void upload_session_start(const upload_session_t* session);
+
+/*  void upload_session_mark(const uint32_t subpage_id)
+ *    Records that subpage_id is in flash; ignored if there is no session
+ */
+void upload_session_mark(const uint32_t subpage_id);
+
+/*  int upload_session_received(const uint32_t subpage_id)
+ *  Return:
+ *    Non-zero if subpage_id has been recorded by upload_session_mark
+ */
+int upload_session_received(const uint32_t subpage_id);
+
+#endif
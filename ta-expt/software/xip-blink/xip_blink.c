@@ -0,0 +1,28 @@
+// xip_blink.c
+// Makes the Tartan Artibeus EXPT board LEDs blink from QSPI flash
+//
+// Written by Bradley Denby
+// Other contributors: None
+//
+// See the top-level LICENSE file for the license.
+
+// libopencm3
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+
+int main(void) {
+  // The bootloader left the 80 MHz clock and the QUADSPI running; resetting
+  // either, or GPIO port C (QUADSPI IO0-IO3, BK2_NCS), stops instruction fetch
+  rcc_periph_clock_enable(RCC_GPIOC);
+  gpio_mode_setup(GPIOC, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO10);
+  gpio_mode_setup(GPIOC, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO12);
+  gpio_set(GPIOC, GPIO10);
+  gpio_clear(GPIOC, GPIO12);
+  while(1) {
+    for(int i=0; i<400000; i++) {
+      __asm__("nop");
+    }
+    gpio_toggle(GPIOC, GPIO10);
+    gpio_toggle(GPIOC, GPIO12);
+  }
+}
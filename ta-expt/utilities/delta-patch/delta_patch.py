@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+#
+# delta_patch.py
+# A Python script that makes a BOOTLOADER_PATCH delta patch between two images
+#
+# Usage: python3 delta_patch.py <old> <new> <patch> [--chunk CHUNK]
+# Assumptions:
+#  - <old> is the raw binary image in the slot that will not be overwritten
+#    (the running or confirmed application), exactly as it was uploaded
+#  - <new> is the raw binary image to build from it (e.g. flight-401-usr.bin)
+# Arguments:
+#  - old: path to the old application image
+#  - new: path to the new application image
+#  - patch: path to write the patch to
+#  - chunk: optional; also prints how many BOOTLOADER_PATCH frames of CHUNK
+#    patch bytes (at most 245) the upload takes
+# Results:
+#  - Writes the patch, checks that it rebuilds the new image from the old one,
+#    and prints the old image CRC-32 (which the bootloader checks first), the
+#    patch length, and the new image length and CRC-32, which are the values
+#    BOOTLOADER_ERASE and BOOTLOADER_JUMP expect
+#
+# Written by Bradley Denby
+# Other contributors: None
+#
+# See the top-level LICENSE file for the license.
+
+import argparse
+import sys
+import zlib
+
+# Patch format; keep in sync with taolst_protocol.h
+PATCH_OP_COPY = 0x00
+PATCH_OP_ADD = 0x01
+PATCH_OP_INSERT = 0x02
+PATCH_OP_SEEK = 0x03
+
+# Match search: seed length, candidates examined per position, and the score
+# (matching bytes minus mismatching bytes) a region needs to be used
+SEED_LEN = 8
+CHAIN_MAX = 32
+SCORE_MIN = 8
+
+# Approximate extension gives up this many bytes past its best score
+EXTEND_SLACK = 256
+
+# Zero runs this short inside an ADD cost less than a COPY between two ADDs
+ZERO_RUN_MIN = 5
+
+def leb128(n):
+  out = bytearray()
+  while True:
+    b = n&0x7f
+    n >>= 7
+    if n:
+      out.append(b|0x80)
+    else:
+      out.append(b)
+      return bytes(out)
+
+def zigzag(d):
+  return (d<<1) if d>=0 else (((-d)<<1)-1)
+
+def extend(old, new, o, i):
+  # bsdiff-style approximate match: the length where matches minus mismatches
+  # peaks, so a few changed bytes (e.g. shifted addresses) stay in the region
+  score = 0
+  best_score = 0
+  best_len = 0
+  j = 0
+  while i+j<len(new) and o+j<len(old) and j-best_len<EXTEND_SLACK:
+    score += 1 if new[i+j]==old[o+j] else -1
+    j += 1
+    if score>best_score:
+      best_score = score
+      best_len = j
+  return (best_score, best_len)
+
+def region_ops(old, new, o, i, length):
+  # Split an aligned region into COPY runs (unchanged bytes) and ADD runs
+  diffs = bytes((new[i+j]-old[o+j])&0xff for j in range(length))
+  runs = []
+  j = 0
+  while j<length:
+    k = j
+    zero = diffs[j]==0
+    while k<length and (diffs[k]==0)==zero:
+      k += 1
+    runs.append([zero, j, k])
+    j = k
+  merged = []
+  for run in runs:
+    inner = 0<run[1] and run[2]<length
+    if run[0] and inner and run[2]-run[1]<ZERO_RUN_MIN:
+      run[0] = False
+    if merged and merged[-1][0]==run[0]:
+      merged[-1][2] = run[2]
+    else:
+      merged.append(run)
+  ops = bytearray()
+  for (zero, start, end) in merged:
+    if zero:
+      ops.append(PATCH_OP_COPY)
+      ops.extend(leb128(end-start))
+    else:
+      ops.append(PATCH_OP_ADD)
+      ops.extend(leb128(end-start))
+      ops.extend(diffs[start:end])
+  return bytes(ops)
+
+def make_patch(old, new):
+  out = bytearray()
+  out.extend(len(old).to_bytes(4, 'little'))
+  out.extend((zlib.crc32(old)&0xffffffff).to_bytes(4, 'little'))
+  seeds = {}
+  for o in range(len(old)-SEED_LEN+1):
+    seeds.setdefault(bytes(old[o:o+SEED_LEN]), []).append(o)
+  literals = bytearray()
+  cursor = 0
+  i = 0
+  while i<len(new):
+    candidates = [cursor] if cursor<len(old) else []
+    candidates.extend(seeds.get(bytes(new[i:i+SEED_LEN]), [])[:CHAIN_MAX])
+    best = (0, 0, 0)
+    for o in candidates:
+      (score, length) = extend(old, new, o, i)
+      if score>best[0]:
+        best = (score, length, o)
+    (score, length, o) = best
+    if score>=SCORE_MIN:
+      if literals:
+        out.append(PATCH_OP_INSERT)
+        out.extend(leb128(len(literals)))
+        out.extend(literals)
+        literals = bytearray()
+      if o!=cursor:
+        out.append(PATCH_OP_SEEK)
+        out.extend(leb128(zigzag(o-cursor)))
+      out.extend(region_ops(old, new, o, i, length))
+      cursor = o+length
+      i += length
+    else:
+      literals.append(new[i])
+      i += 1
+  if literals:
+    out.append(PATCH_OP_INSERT)
+    out.extend(leb128(len(literals)))
+    out.extend(literals)
+  return bytes(out)
+
+def apply_patch(old, patch):
+  old_len = int.from_bytes(patch[0:4], 'little')
+  old_crc = int.from_bytes(patch[4:8], 'little')
+  if old_len!=len(old) or old_crc!=(zlib.crc32(old)&0xffffffff):
+    return None
+  out = bytearray()
+  cursor = 0
+  i = 8
+  while i<len(patch):
+    op = patch[i]
+    i += 1
+    n = 0
+    shift = 0
+    while True:
+      b = patch[i]
+      i += 1
+      n |= (b&0x7f)<<shift
+      shift += 7
+      if not b&0x80:
+        break
+    if op==PATCH_OP_COPY:
+      out.extend(old[cursor:cursor+n])
+      cursor += n
+    elif op==PATCH_OP_ADD:
+      for j in range(n):
+        out.append((old[cursor+j]+patch[i+j])&0xff)
+      cursor += n
+      i += n
+    elif op==PATCH_OP_INSERT:
+      out.extend(patch[i:i+n])
+      i += n
+    else:
+      cursor += -((n>>1)+1) if n&1 else (n>>1)
+  return bytes(out)
+
+def main():
+  parser = argparse.ArgumentParser(description='Make a delta patch')
+  parser.add_argument('old')
+  parser.add_argument('new')
+  parser.add_argument('patch')
+  parser.add_argument('--chunk', type=int, default=0)
+  args = parser.parse_args()
+  with open(args.old, 'rb') as f:
+    old = f.read()
+  with open(args.new, 'rb') as f:
+    new = f.read()
+  patch = make_patch(old, new)
+  if apply_patch(old, patch)!=new:
+    print('error: patch does not rebuild the new image', file=sys.stderr)
+    sys.exit(1)
+  with open(args.patch, 'wb') as f:
+    f.write(patch)
+  print('old:   {} bytes, CRC-32 0x{:08x}'.format(
+    len(old), zlib.crc32(old)&0xffffffff
+  ))
+  print('new:   {} bytes, CRC-32 0x{:08x}'.format(
+    len(new), zlib.crc32(new)&0xffffffff
+  ))
+  print('patch: {} bytes ({:.1f}% of new)'.format(
+    len(patch), 100.0*len(patch)/max(len(new), 1)
+  ))
+  if args.chunk>0:
+    chunk = min(args.chunk, 245)
+    print('frames: {} of up to {} bytes'.format(
+      (len(patch)+chunk-1)//chunk, chunk
+    ))
+
+if __name__ == '__main__':
+  main()
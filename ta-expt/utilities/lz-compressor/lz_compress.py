@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+#
+# lz_compress.py
+# A Python script that compresses an application image for BOOTLOADER_WRITE_LZ
+#
+# Usage: python3 lz_compress.py <image> <stream> [--chunk CHUNK]
+# Assumptions:
+#  - <image> is a raw binary application image (e.g. flight-401-usr.bin)
+# Arguments:
+#  - image: path to the application image
+#  - stream: path to write the compressed stream to
+#  - chunk: optional; also prints how many BOOTLOADER_WRITE_LZ frames of CHUNK
+#    stream bytes (at most 245) the upload takes
+# Results:
+#  - Writes the compressed stream, checks that it decompresses to the image,
+#    and prints the image length, stream length and image CRC-32, which are
+#    the values BOOTLOADER_ERASE and BOOTLOADER_JUMP expect
+#
+# Written by Bradley Denby
+# Other contributors: None
+#
+# See the top-level LICENSE file for the license.
+
+import argparse
+import sys
+import zlib
+
+# Stream format; keep in sync with taolst_protocol.h
+LZ_MATCH_MIN = 3
+LZ_MATCH_MAX = 0x7f+LZ_MATCH_MIN
+LZ_LITERAL_MAX = 0x80
+LZ_DIST_MAX = 0xffff
+
+# Match search effort: candidates examined per position
+CHAIN_MAX = 64
+
+def compress(image):
+  out = bytearray()
+  literals = bytearray()
+  chains = {}
+  def flush_literals():
+    while literals:
+      run = literals[:LZ_LITERAL_MAX]
+      out.append(len(run)-1)
+      out.extend(run)
+      del literals[:LZ_LITERAL_MAX]
+  def insert(pos):
+    if pos+LZ_MATCH_MIN<=len(image):
+      chains.setdefault(bytes(image[pos:pos+LZ_MATCH_MIN]), []).append(pos)
+  pos = 0
+  while pos<len(image):
+    best_len = 0
+    best_dist = 0
+    if pos+LZ_MATCH_MIN<=len(image):
+      candidates = chains.get(bytes(image[pos:pos+LZ_MATCH_MIN]), [])
+      for cand in reversed(candidates[-CHAIN_MAX:]):
+        dist = pos-cand
+        if dist>LZ_DIST_MAX:
+          break
+        length = 0
+        limit = min(LZ_MATCH_MAX, len(image)-pos)
+        while length<limit and image[cand+length]==image[pos+length]:
+          length += 1
+        if length>best_len:
+          best_len = length
+          best_dist = dist
+          if length==limit:
+            break
+    if best_len>=LZ_MATCH_MIN:
+      flush_literals()
+      out.append(0x80|(best_len-LZ_MATCH_MIN))
+      out.append(best_dist&0xff)
+      out.append(best_dist>>8)
+      for i in range(best_len):
+        insert(pos+i)
+      pos += best_len
+    else:
+      literals.append(image[pos])
+      insert(pos)
+      pos += 1
+  flush_literals()
+  return bytes(out)
+
+def decompress(stream):
+  out = bytearray()
+  i = 0
+  while i<len(stream):
+    c = stream[i]
+    i += 1
+    if c<0x80:
+      out.extend(stream[i:i+c+1])
+      i += c+1
+    else:
+      dist = stream[i]|(stream[i+1]<<8)
+      i += 2
+      for _ in range((c&0x7f)+LZ_MATCH_MIN):
+        out.append(out[-dist])
+  return bytes(out)
+
+def main():
+  parser = argparse.ArgumentParser(description='Compress an application image')
+  parser.add_argument('image')
+  parser.add_argument('stream')
+  parser.add_argument('--chunk', type=int, default=0)
+  args = parser.parse_args()
+  with open(args.image, 'rb') as f:
+    image = f.read()
+  stream = compress(image)
+  if decompress(stream)!=image:
+    print('error: stream does not decompress to the image', file=sys.stderr)
+    sys.exit(1)
+  with open(args.stream, 'wb') as f:
+    f.write(stream)
+  print('image:  {} bytes, CRC-32 0x{:08x}'.format(
+    len(image), zlib.crc32(image)&0xffffffff
+  ))
+  print('stream: {} bytes ({:.1f}%)'.format(
+    len(stream), 100.0*len(stream)/max(len(image), 1)
+  ))
+  if args.chunk>0:
+    chunk = min(args.chunk, 245)
+    print('frames: {} of up to {} bytes'.format(
+      (len(stream)+chunk-1)//chunk, chunk
+    ))
+
+if __name__ == '__main__':
+  main()
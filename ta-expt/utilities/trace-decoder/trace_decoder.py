@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+#
+# trace_decoder.py
+# A Python script that decodes the ta-expt binary trace stream
+#
+# Usage: python3 trace_decoder.py <source> [--baud BAUD] [--hz HZ]
+# Assumptions:
+#  - <source> is either a capture file or a serial device connected to the
+#    trace UART (UART4 TX, PA0); reading a serial device requires pyserial
+# Arguments:
+#  - source: path to a capture file or serial device (e.g. /dev/ttyUSB1)
+#  - baud: serial baud rate; defaults to TRACE_BAUD (2000000)
+#  - hz: core clock frequency used to convert cycles; defaults to 80000000
+# Results:
+#  - Prints one line per record: time in microseconds since the first record,
+#    sequence number, event name, and arguments. Sequence number gaps are
+#    reported as dropped records.
+#
+# Written by Bradley Denby
+# Other contributors: None
+#
+# See the top-level LICENSE file for the license.
+
+import argparse
+import sys
+
+# Record layout; keep in sync with trace.h
+TRACE_SYNC_BYTE = 0xa5
+TRACE_HDR_LEN = 7
+TRACE_MAX_ARGS = 2
+
+# Event IDs and names; keep in sync with trace.h
+TRACE_EVENTS = {
+  0x01: 'BOOT',
+  0x02: 'CMD',
+  0x03: 'REPLY',
+  0x04: 'WAKE',
+  0x05: 'BAUD',
+  0x06: 'BAUD_FALLBACK',
+  0x07: 'JUMP',
+  0x08: 'LSI_CAL',
+  0x09: 'QUEUE_RUN',
+  0x0a: 'TIME_ADJ',
+  0x0b: 'JOB_OVERRUN',
+  0x0c: 'BEACON',
+  0x0d: 'SLOT_FAIL'
+}
+
+def open_source(source, baud):
+  try:
+    import serial
+    try:
+      return serial.Serial(source, baud, timeout=None)
+    except (serial.SerialException, ValueError):
+      pass
+  except ImportError:
+    pass
+  return open(source, 'rb')
+
+def records(stream):
+  buff = bytearray()
+  while True:
+    chunk = stream.read(1 if hasattr(stream, 'baudrate') else 4096)
+    if not chunk:
+      return
+    buff.extend(chunk)
+    while True:
+      # Resynchronize on the sync byte
+      start = buff.find(TRACE_SYNC_BYTE)
+      if start<0:
+        buff.clear()
+        break
+      del buff[:start]
+      if len(buff)<TRACE_HDR_LEN:
+        break
+      nargs = buff[2]&0x03
+      if nargs>TRACE_MAX_ARGS or buff[1] not in TRACE_EVENTS:
+        del buff[0]
+        continue
+      length = TRACE_HDR_LEN+4*nargs
+      if len(buff)<length:
+        break
+      seq = buff[2]>>2
+      cycles = int.from_bytes(buff[3:7], 'little')
+      args = [
+        int.from_bytes(buff[TRACE_HDR_LEN+4*i:TRACE_HDR_LEN+4*i+4], 'little')
+        for i in range(nargs)
+      ]
+      yield (buff[1], seq, cycles, args)
+      del buff[:length]
+
+def main():
+  parser = argparse.ArgumentParser(description='Decode the ta-expt trace')
+  parser.add_argument('source')
+  parser.add_argument('--baud', type=int, default=2000000)
+  parser.add_argument('--hz', type=float, default=80e6)
+  args = parser.parse_args()
+  stream = open_source(args.source, args.baud)
+  last_seq = None
+  last_cycles = None
+  elapsed = 0
+  dropped = 0
+  try:
+    for (event, seq, cycles, event_args) in records(stream):
+      if last_seq is not None:
+        gap = (seq-last_seq-1)&0x3f
+        if gap:
+          dropped += gap
+          print('          ---- {} record(s) dropped'.format(gap))
+        # The cycle counter wraps every 2^32 cycles (about 53.7 s at 80 MHz)
+        elapsed += (cycles-last_cycles)&0xffffffff
+      last_seq = seq
+      last_cycles = cycles
+      print('{:14.3f} us  #{:02d}  {:<13s} {}'.format(
+        elapsed*1e6/args.hz, seq, TRACE_EVENTS[event],
+        ' '.join('0x{:08x}'.format(a) for a in event_args)
+      ))
+  except KeyboardInterrupt:
+    pass
+  print('dropped: {}'.format(dropped), file=sys.stderr)
+
+if __name__ == '__main__':
+  main()